@@ -1,20 +1,30 @@
 #pragma once
 
 #include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#endif
+
+#include <timer.h>
 
 static inline uint64_t arch_timestamp_begin(void);
 static inline uint64_t arch_timestamp_end(void);
+/* Hint to the CPU that we are in a busy-wait loop. */
+static inline void arch_relax(void);
+/* Read the timer selected with --timer. */
+static inline uint64_t arch_timer_begin(const struct timer *timer);
+static inline uint64_t arch_timer_end(const struct timer *timer);
 
 struct pmu;
 
-static struct pmu *arch_pmu_init(const char **pmcs, const unsigned num_pmcs,
-                                 const unsigned cpu);
-static void arch_pmu_free(struct pmu *pmus);
-static void arch_pmu_begin(struct pmu *pmus, uint64_t *data);
-static void arch_pmu_end(struct pmu *pmus, uint64_t *data);
-
 #ifdef __aarch64__
 
+/* The PMU is programmed directly; see arch_pmu in pmu.c. */
+#define ARCH_HAVE_PMU
+
 static inline uint64_t timestamp() {
   uint64_t value;
   // Read CCNT Register
@@ -24,6 +34,18 @@ static inline uint64_t timestamp() {
 
 static inline uint64_t arch_timestamp_begin(void) { return timestamp(); }
 static inline uint64_t arch_timestamp_end(void) { return timestamp(); }
+static inline void arch_relax(void) { __asm__ volatile("yield" ::: "memory"); }
+
+/* DC CIVAC is allowed at EL0 by Linux (SCTLR_EL1.UCI). */
+#define ARCH_HAVE_FLUSH
+static inline int arch_flush_opt(void) { return 0; }
+static inline void arch_flush_line(const void *p, const int opt) {
+  (void)opt;
+  __asm__ volatile("dc civac, %0" ::"r"(p) : "memory");
+}
+static inline void arch_flush_fence(void) {
+  __asm__ volatile("dsb ish" ::: "memory");
+}
 
 struct pmu_event {
   const char *name;
@@ -31,7 +53,7 @@ struct pmu_event {
 };
 
 /* ARM ARM D5.10 */
-const struct pmu_event pmu_events[] = {
+static const struct pmu_event pmu_events[] = {
     {"SW_INCR", 0x00},          {"L1I_CACHE_REFILL", 0x01},
     {"L1D_CACHE_REFILL", 0x03}, {"L1D_CACHE", 0x04},
     {"MEM_ACCESS", 0x13},       {"L2D_CACHE", 0x16},
@@ -80,8 +102,9 @@ static int str2type(const char *name, uint64_t *out) {
   return -1;
 }
 
-static struct pmu *arch_pmu_init(const char **pmcs, const unsigned num_pmcs,
-                                 const unsigned cpu) {
+static inline struct pmu *arch_pmu_init(const char **pmcs,
+                                        const unsigned num_pmcs,
+                                        const unsigned cpu) {
   uint64_t value;
 
   __asm__ volatile("mrs %0, PMCR_EL0" : "=r"(value));
@@ -122,7 +145,7 @@ static struct pmu *arch_pmu_init(const char **pmcs, const unsigned num_pmcs,
   return pmu;
 }
 
-static void arch_pmu_free(struct pmu *pmus) {
+static inline void arch_pmu_free(struct pmu *pmus) {
   for (unsigned i = 0; i < pmus->num_pmcs; ++i) {
     select_reg(i);
     disable_reg(i);
@@ -131,7 +154,7 @@ static void arch_pmu_free(struct pmu *pmus) {
   free(pmus);
 }
 
-static void arch_pmu_begin(struct pmu *pmus, uint64_t *data) {
+static inline void arch_pmu_begin(struct pmu *pmus, uint64_t *data) {
   for (unsigned i = 0; i < pmus->num_pmcs; ++i) {
     // clear overflow flag
     __asm__ volatile("msr PMOVSCLR_EL0, %0" : : "r"((uint64_t)1 << i));
@@ -143,7 +166,7 @@ static void arch_pmu_begin(struct pmu *pmus, uint64_t *data) {
   isb();
 }
 
-static void arch_pmu_end(struct pmu *pmus, uint64_t *data) {
+static inline void arch_pmu_end(struct pmu *pmus, uint64_t *data) {
   uint64_t ovf = 0;
   __asm__ volatile("mrs %0, PMOVSSET_EL0" : "=r"(ovf));
 
@@ -166,14 +189,7 @@ static inline uint64_t timestamp() {
 
 static inline uint64_t arch_timestamp_begin(void) { return timestamp(); }
 static inline uint64_t arch_timestamp_end(void) { return timestamp(); }
-
-static struct pmu *arch_pmu_init(const char **pmcs, const unsigned num_pmcs,
-                                 const unsigned cpu) {
-  return NULL;
-}
-static void arch_pmu_free(struct pmu *pmus) {}
-static void arch_pmu_begin(struct pmu *pmus, uint64_t *data) {}
-static void arch_pmu_end(struct pmu *pmus, uint64_t *data) {}
+static inline void arch_relax(void) { __asm__ volatile("" ::: "memory"); }
 
 #elif defined(__x86_64__)
 
@@ -198,356 +214,64 @@ static inline uint64_t arch_timestamp_end(void) {
   return (uint64_t)high << 32ULL | low;
 }
 
-#ifdef JEVENTS_FOUND
-#include <fcntl.h>
-#include <stdio.h>
-#include <sys/stat.h>
-#include <sys/types.h>
-
-#include <jevents.h>
-#include <rdpmc.h>
-#include <mckernel.h>
-#include <sys/ioctl.h>
-#include <linux/perf_event.h>
-
-static uint64_t rdpmc(const uint32_t counter) {
-  uint32_t low, high;
-  __asm__ volatile("rdpmc" : "=a"(low), "=d"(high) : "c"(counter));
-  return (uint64_t)high << 32 | low;
-}
+static inline void arch_relax(void) { __asm__ volatile("pause" ::: "memory"); }
 
-static uint64_t rdmsr(const uint32_t idx, const int fd) {
-  if (mck_is_mckernel()) {
-    return syscall(850, idx);
-  } else {
-    uint64_t v;
-    const ssize_t ret = pread(fd, &v, sizeof(v), idx);
-    if (ret != sizeof(v)) {
-      printf("Reading MSR failed\n");
-    }
-    return v;
+#define ARCH_HAVE_FLUSH
+/* Whether the CPU has CLFLUSHOPT: CPUID.(EAX=7,ECX=0):EBX[23]. */
+static inline int arch_flush_opt(void) {
+  unsigned a = 0, b, c = 0, d;
+  __asm__ volatile("cpuid" : "+a"(a), "=b"(b), "+c"(c), "=d"(d));
+  if (a < 7) {
+    return 0;
   }
+  a = 7;
+  c = 0;
+  __asm__ volatile("cpuid" : "+a"(a), "=b"(b), "+c"(c), "=d"(d));
+  return (b >> 23) & 1;
 }
-
-static uint64_t wrmsr(const uint32_t idx, const uint64_t val, const int fd) {
-  if (mck_is_mckernel()) {
-    return syscall(851, idx, val);
+static inline void arch_flush_line(const void *p, const int opt) {
+  if (opt) {
+    /* CLFLUSHOPT, spelled for assemblers that do not know it. */
+    __asm__ volatile(".byte 0x66; clflush %0" : "+m"(*(volatile char *)p));
   } else {
-    const ssize_t ret = pwrite(fd, &val, sizeof(val), idx);
-    if (ret != sizeof(val)) {
-      printf("Writing MSR %x failed\n", idx);
-    }
-    return ret;
-  }
-}
-
-enum msrs {
-  IA32_PMC_BASE = 0x0c1,
-  IA32_PERFEVTSEL_BASE = 0x186,
-  IA32_FIXED_CTR_CTRL = 0x38d,
-  IA32_PERF_GLOBAL_STATUS = 0x38e,
-  IA32_PERF_GLOBAL_CTRL = 0x38f,
-  IA32_PERF_GLOBAL_OVF_CTRL = 0x390,
-  IA32_PERF_CAPABILITIES = 0x345,
-  IA32_DEBUGCTL = 0x1d9,
-};
-
-static inline void cpuid(const int code, uint32_t *a, uint32_t *b, uint32_t *c,
-                         uint32_t *d) {
-  asm volatile("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(code));
-}
-
-#define MASK(v, high, low) ((v >> low) & ((1 << (high - low + 1)) - 1))
-
-struct pmu {
-  struct rdpmc_ctx *ctx;
-  int *perf_fds;
-  unsigned active;
-  int mckernel;
-  char *msr;
-  int msr_fd;
-  uint64_t global_ctrl;
-};
-
-static void pmu_info(struct pmu *pmus) {
-  uint32_t eax, ebx, ecx, edx;
-
-  cpuid(0x1, &eax, &ebx, &ecx, &edx);
-
-  printf("EAX: %08x\n", eax);
-  printf("EBX: %08x\n", ebx);
-  printf("ECX: %08x\n", ecx);
-  printf("EDX: %08x\n", edx);
-
-  if (ecx & (1 << 15)) {
-    const uint64_t caps = rdmsr(IA32_PERF_CAPABILITIES, pmus->msr_fd);
-    const int vmm_freeze = MASK(caps, 12, 12);
-    printf("Caps: %08x\n", caps);
-    printf("VMM Freeze: %u\n", vmm_freeze);
-    if (vmm_freeze) {
-      const uint64_t debugctl = rdmsr(IA32_DEBUGCTL, pmus->msr_fd);
-      wrmsr(IA32_DEBUGCTL, debugctl & ~(1 << 14), pmus->msr_fd);
-    }
+    __asm__ volatile("clflush %0" : "+m"(*(volatile char *)p));
   }
-
-  cpuid(0xa, &eax, &ebx, &ecx, &edx);
-
-  const unsigned version = MASK(eax, 7, 0);
-  const unsigned counters = MASK(eax, 15, 8);
-  const unsigned width = MASK(eax, 23, 16);
-
-  const unsigned ffpc = MASK(edx, 4, 0);
-  const unsigned ff_width = MASK(edx, 12, 5);
-
-  printf("EAX: %08x\n", eax);
-  printf("EBX: %08x\n", ebx);
-  printf("ECX: %08x\n", ecx);
-  printf("EDX: %08x\n", edx);
-  printf("PMC version %u\n", version);
-  printf("PMC counters: %u\n", counters);
-  printf("PMC width: %u\n", width);
-
-  printf("FFPCs: %u, width: %u\n", ffpc, ff_width);
 }
-
-#define LINUX_JEVENTS
-//#define LINUX_PERF
-//#define LINUX_RAWMSR
-#define MCK_MCK
-//#define MCK_RAWMSR
-
-#if defined(LINUX_RAWMSR) || defined(MCK_RAWMSR)
-#define RAWMSR
-#endif
-
-#if (defined(LINUX_JEVENTS) + defined(LINUX_PERF) + defined(LINUX_RAWMSR)) > 1
-#error "More than one PMU method for Linux selected."
-#endif
-
-#if (defined(MCK_MCK) + defined(MCK_RAWMSR)) > 1
-#error "More than one PMU method for McKernel selected."
-#endif
-
-static struct pmu *arch_pmu_init(const char **pmcs, const unsigned num_pmcs,
-                                 const unsigned cpu) {
-  struct pmu *pmus = (struct pmu *)malloc(sizeof(struct pmu));
-  pmus->ctx = (struct rdpmc_ctx *)malloc(sizeof(struct rdpmc_ctx) * num_pmcs);
-  pmus->perf_fds = (int *)malloc(sizeof(int) * num_pmcs);
-  pmus->active = 0;
-  pmus->mckernel = mck_is_mckernel();
-  asprintf(&pmus->msr, "/dev/cpu/%u/msr", cpu);
-
-#if defined(RAWMSR)
-  if (!mck_is_mckernel()) {
-    pmus->msr_fd = open(pmus->msr, O_RDWR);
-    if (pmus->msr_fd < 0) {
-      printf("Opening MSR failed: %d %s\n", errno, strerror(errno));
-      exit(EXIT_FAILURE);
-    }
-  }
-
-  pmu_info(pmus);
-#endif
-
-#if defined(MCK_MCK) || defined(RAWMSR)
-  pmus->global_ctrl = rdmsr(IA32_PERF_GLOBAL_CTRL, -1);
-#endif
-
-  for (unsigned i = 0; i < num_pmcs; ++i) {
-    struct perf_event_attr attr;
-    const char *event = pmcs[i];
-    int err = resolve_event(event, &attr);
-    if (err) {
-      printf("Error resolving event: \"%s\".\n", event);
-      continue;
-    }
-
-    if (pmus->mckernel) {
-#if defined(MCK_MCK)
-      err = mck_pmc_init(pmus->active, attr.config, 0x4);
-      if (err) {
-        printf("Error configuring PMU with \"%s\" %x\n", event, attr.config);
-        continue;
-      }
-#elif defined(MCK_RAWMSR)
-      const uint64_t v = (1 << 22) | (1 << 16) | attr.config;
-      wrmsr(IA32_PERFEVTSEL_BASE + i, v, pmus->msr_fd);
-#else
-      fprintf(stderr, "PMU method not implmented in McKernel.\n");
-#endif
-    } else {
-#if defined(LINUX_JEVENTS)
-      err = rdpmc_open_attr(&attr, &pmus->ctx[pmus->active], NULL);
-      if (err) {
-        printf("Error opening RDPMC context for event \"%s\"\n", event);
-        continue;
-      }
-#elif defined(LINUX_PERF)
-      struct perf_event_attr pe;
-      memset(&pe, 0, sizeof(pe));
-      pe.config = attr.config;
-      pe.config1 = attr.config1;
-      pe.config2 = attr.config2;
-      pe.type = attr.type;
-      pe.size = attr.size;
-      // attr.disabled = 1;
-      pe.exclude_kernel = 1;
-      pe.exclude_hv = 1;
-      err = perf_event_open(&attr, 0, -1, -1, 0);
-      if (err < 0) {
-        printf("perf_event_open failed \"%s\" %d %s\n", event, errno , strerror(errno));
-        continue;
-      }
-      pmus->perf_fds[pmus->active] = err;
-#elif defined(LINUX_RAWMSR)
-      const uint64_t v = (1 << 22) | (1 << 16) | attr.config;
-      wrmsr(IA32_PERFEVTSEL_BASE + i, v, pmus->msr_fd);
-#else
-      fprintf(stderr, "PMU method not implemented in Linux.\n");
-#endif
-    }
-
-    ++pmus->active;
-  }
-
-  if (pmus->mckernel) {
-#if defined(MCK_RAWMSR)
-    wrmsr(IA32_PERF_GLOBAL_CTRL, 0, pmus->msr_fd);
-#elif defined(MCK_MCK)
-    /* If PMUs are deactivated activate them now.
-     * McKernel only initializes them on boot.
-     * If, for example RAWMSR turns them off, they stay off.
-     */
-    if (pmus->global_ctrl == 0) {
-      wrmsr(IA32_PERF_GLOBAL_CTRL, (1 << pmus->active) - 1, -1);
-    }
-#endif
-  } else {
-#if defined(LINUX_RAWMSR)
-    wrmsr(IA32_PERF_GLOBAL_CTRL, 0, pmus->msr_fd);
-#endif
-  }
-
-  return pmus;
+static inline void arch_flush_fence(void) {
+  __asm__ volatile("mfence" ::: "memory");
 }
 
-static void arch_pmu_free(struct pmu *pmus) {
-  if (!pmus->mckernel) {
-    for (unsigned i = 0; i < pmus->active; ++i) {
-#if defined(LINUX_JEVENTS)
-      rdpmc_close(&pmus->ctx[i]);
-#elif defined(LINUX_PERF)
-      close(pmus->perf_fds[i]);
-#elif defined(LINUX_RAWMSR)
-      wrmsr(IA32_PERFEVTSEL_BASE + i, 0, pmus->msr_fd);
-#endif
-    }
-
-#if defined(LINUX_RAWMSR)
-    wrmsr(IA32_PERF_GLOBAL_CTRL, pmus->global_ctrl, pmus->msr_fd);
-    close(pmus->msr_fd);
-#endif
-  } else {
-    wrmsr(IA32_PERF_GLOBAL_CTRL, pmus->global_ctrl, pmus->msr_fd);
-  }
-
-  free(pmus->ctx);
-  free(pmus->perf_fds);
-  free(pmus->msr);
-  free(pmus);
+/* LFENCE waits for all earlier instructions to complete and keeps later ones
+ * from starting; much cheaper than CPUID. */
+static inline uint64_t arch_timestamp_lfence_begin(void) {
+  unsigned high, low;
+  __asm__ volatile("LFENCE\n\t"
+                   "RDTSC\n\t"
+                   "LFENCE\n\t"
+                   : "=d"(high), "=a"(low)::"memory");
+  return (uint64_t)high << 32ULL | low;
 }
 
-static void arch_pmu_begin(struct pmu *pmus, uint64_t *data) {
-  if (pmus->mckernel) {
-    for (unsigned i = 0; i < pmus->active; ++i) {
-#if defined(MCK_MCK)
-      mck_pmc_reset(i);
-#elif defined(MCK_RAWMSR)
-      wrmsr(IA32_PMC_BASE + i, 0, -1);
-#endif
-    }
-
-#if defined(MCK_RAWMSR)
-    const uint64_t mask = (1 << pmus->active) - 1;
-    wrmsr(IA32_PERF_GLOBAL_OVF_CTRL, 0, pmus->msr_fd);
-    wrmsr(IA32_PERF_GLOBAL_CTRL, mask, pmus->msr_fd);
-#endif
-  } else {
-    for (unsigned i = 0; i < pmus->active; ++i) {
-#if defined(LINUX_JEVENTS)
-      data[i] = rdpmc_read(&pmus->ctx[i]);
-#elif defined(LINUX_PERF)
-      if (ioctl(pmus->perf_fds[i], PERF_EVENT_IOC_RESET, 0)) {
-        printf("Error in ioctl\n");
-      }
-#elif defined(LINUX_RAWMSR)
-      wrmsr(IA32_PMC_BASE + i, 0, pmus->msr_fd);
-#endif
-    }
-
-#if defined(LINUX_RAWMSR)
-    const uint64_t mask = (1 << pmus->active) - 1;
-    wrmsr(IA32_PERF_GLOBAL_OVF_CTRL, 0, pmus->msr_fd);
-    wrmsr(IA32_PERF_GLOBAL_CTRL, mask, pmus->msr_fd);
-#endif
-  }
+static inline uint64_t arch_timestamp_lfence_end(void) {
+  unsigned high, low;
+  __asm__ volatile("LFENCE\n\t"
+                   "RDTSC\n\t"
+                   : "=d"(high), "=a"(low)::"memory");
+  return (uint64_t)high << 32ULL | low;
 }
 
-static void arch_pmu_end(struct pmu *pmus, uint64_t *data) {
-  if (pmus->mckernel) {
-#if defined(MCK_RAWMSR)
-    wrmsr(IA32_PERF_GLOBAL_CTRL, 0, pmus->msr_fd);
-    const uint64_t ovf = rdmsr(IA32_PERF_GLOBAL_STATUS, pmus->msr_fd);
-    if (ovf) {
-      printf("OVF: %08x\n", ovf);
-      wrmsr(IA32_PERF_GLOBAL_OVF_CTRL, 0, pmus->msr_fd);
-    }
-#endif
-  } else {
-#if defined(LINUX_RAWMSR)
-    wrmsr(IA32_PERF_GLOBAL_CTRL, 0, pmus->msr_fd);
-    const uint64_t ovf = rdmsr(IA32_PERF_GLOBAL_STATUS, pmus->msr_fd);
-    if (ovf) {
-      printf("OVF: %08x\n", ovf);
-      wrmsr(IA32_PERF_GLOBAL_OVF_CTRL, 0, pmus->msr_fd);
-    }
-#endif
-  }
-
-  for (unsigned i = 0; i < pmus->active; ++i) {
-    if (pmus->mckernel) {
-#if defined(MCK_MCK)
-      data[i] = rdpmc(i);
-#elif defined(MCK_RAWMSR)
-      data[i] = rdmsr(IA32_PMC_BASE + i, pmus->msr_fd);
-#endif
-    } else {
-#if defined(LINUX_JEVENTS)
-      data[i] = rdpmc_read(&pmus->ctx[i]) - data[i];
-#elif defined(LINUX_PERF)
-      read(pmus->perf_fds[i], &data[i], sizeof(long long));
-#elif defined(LINUX_RAWMSR)
-      data[i] = rdmsr(IA32_PMC_BASE + i, pmus->msr_fd);
-#endif
-    }
-  }
+/* RDTSCP waits for earlier instructions, but later ones may start early. */
+static inline uint64_t arch_timestamp_rdtscp(void) {
+  unsigned high, low;
+  __asm__ volatile("RDTSCP\n\t" : "=d"(high), "=a"(low)::"%rcx", "memory");
+  return (uint64_t)high << 32ULL | low;
 }
 
-#else /* JEVENTS_FOUND */
-
-static struct pmu *arch_pmu_init(const char **pmcs, const unsigned num_pmcs,
-                                 const unsigned cpu) {
-  if (num_pmcs) {
-    fprintf(stderr, "PMC support not compiled in.\n");
-    exit(EXIT_FAILURE);
-  }
-  return NULL;
+static inline uint64_t arch_rdpmc(const uint32_t counter) {
+  uint32_t low, high;
+  __asm__ volatile("rdpmc" : "=a"(low), "=d"(high) : "c"(counter));
+  return (uint64_t)high << 32 | low;
 }
-static void arch_pmu_free(struct pmu *pmus) {}
-static void arch_pmu_begin(struct pmu *pmus, uint64_t *data) {}
-static void arch_pmu_end(struct pmu *pmus, uint64_t *data) {}
-
-#endif /* JEVENTS_FOUND */
 
 #elif defined(__bgq__)
 
@@ -555,9 +279,12 @@ static void arch_pmu_end(struct pmu *pmus, uint64_t *data) {}
 
 static inline uint64_t arch_timestamp_begin(void) { return GetTimeBase(); }
 static inline uint64_t arch_timestamp_end(void) { return GetTimeBase(); }
+static inline void arch_relax(void) { __asm__ volatile("" ::: "memory"); }
 
 #ifdef HAVE_BGPM
 
+#define ARCH_HAVE_PMU
+
 #include <bgpm/include/bgpm.h>
 
 struct pmu_evt {
@@ -565,11 +292,11 @@ struct pmu_evt {
   unsigned id;
 };
 
-struct pmu_evt events[] = {
+static const struct pmu_evt events[] = {
     {"PEVT_LSU_COMMIT_LD_MISSES", PEVT_LSU_COMMIT_LD_MISSES},
     {"PEVT_L2_MISSES", PEVT_L2_MISSES}};
 
-int find_event(const char *const name, unsigned *id) {
+static inline int find_event(const char *const name, unsigned *id) {
   const unsigned elems = sizeof(events) / sizeof(struct pmu_evt);
   for (unsigned i = 0; i < elems; ++i) {
     if (strcasecmp(name, events[i].name) == 0) {
@@ -586,8 +313,9 @@ struct pmu {
   int evt_set;
 };
 
-static struct pmu *arch_pmu_init(const char **pmcs, const unsigned num_pmcs,
-                                 const unsigned cpu) {
+static inline struct pmu *arch_pmu_init(const char **pmcs,
+                                        const unsigned num_pmcs,
+                                        const unsigned cpu) {
   if (num_pmcs == 0) {
     return NULL;
   }
@@ -633,7 +361,7 @@ static struct pmu *arch_pmu_init(const char **pmcs, const unsigned num_pmcs,
   return pmu;
 }
 
-static void arch_pmu_free(struct pmu *pmus) {
+static inline void arch_pmu_free(struct pmu *pmus) {
   if (pmus == NULL) {
     return;
   }
@@ -653,7 +381,7 @@ static void arch_pmu_free(struct pmu *pmus) {
   free(pmus);
 }
 
-static void arch_pmu_begin(struct pmu *pmus, uint64_t *data) {
+static inline void arch_pmu_begin(struct pmu *pmus, uint64_t *data) {
   if (pmus == NULL) {
     return;
   }
@@ -671,7 +399,7 @@ static void arch_pmu_begin(struct pmu *pmus, uint64_t *data) {
   }
 }
 
-static void arch_pmu_end(struct pmu *pmus, uint64_t *data) {
+static inline void arch_pmu_end(struct pmu *pmus, uint64_t *data) {
   if (pmus == NULL) {
     return;
   }
@@ -689,21 +417,11 @@ static void arch_pmu_end(struct pmu *pmus, uint64_t *data) {
   }
 }
 
-#else /* HAVE_BGPM */
-
-static struct pmu *arch_pmu_init(const char **pmcs, const unsigned num_pmcs,
-                                 const unsigned cpu) {
-  return NULL;
-}
-static void arch_pmu_free(struct pmu *pmus) {}
-static void arch_pmu_begin(struct pmu *pmus, uint64_t *data) {}
-static void arch_pmu_end(struct pmu *pmus, uint64_t *data) {}
-
 #endif /* HAVE_BGPM */
 
 #elif defined(__ppc__) || defined(_ARCH_PPC) || defined(__PPC__)
 
-uint64_t read_timebase() {
+static inline uint64_t read_timebase(void) {
 #if defined(__powerpc64__) || defined(_ARCH_PPC64)
   uint64_t ticks;
   __asm__ volatile("mftb %0" : "=r"(ticks));
@@ -721,17 +439,95 @@ uint64_t read_timebase() {
 
 static inline uint64_t arch_timestamp_begin(void) { return read_timebase(); }
 static inline uint64_t arch_timestamp_end(void) { return read_timebase(); }
+/* Drop and restore SMT priority (HMT_low; HMT_medium), as Linux does. */
+static inline void arch_relax(void) {
+  __asm__ volatile("or 1,1,1\n\tor 2,2,2" ::: "memory");
+}
 
-static struct pmu *arch_pmu_init(const char **pmcs, const unsigned num_pmcs,
-                                 const unsigned cpu) {
-  return NULL;
+#define ARCH_HAVE_FLUSH
+static inline int arch_flush_opt(void) { return 0; }
+static inline void arch_flush_line(const void *p, const int opt) {
+  (void)opt;
+  __asm__ volatile("dcbf 0,%0" ::"r"(p) : "memory");
+}
+static inline void arch_flush_fence(void) {
+  __asm__ volatile("sync" ::: "memory");
 }
-static void arch_pmu_free(struct pmu *pmus) {}
-static void arch_pmu_begin(struct pmu *pmus, uint64_t *data) {}
-static void arch_pmu_end(struct pmu *pmus, uint64_t *data) {}
 
 #else
 
 #error "Unkown/Unsupported architecture"
 
 #endif
+
+static inline uint64_t arch_clock_gettime(void) {
+  struct timespec ts = {0, 0};
+#ifdef HAVE_CLOCK_GETTIME
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#endif
+  return (uint64_t)ts.tv_sec * 1000 * 1000 * 1000 + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t arch_perf_cycles(const struct timer *timer) {
+#if defined(__linux__) && defined(__x86_64__)
+  /* Self-monitoring read with rdpmc, as documented in perf_event_open(2). */
+  const volatile struct perf_event_mmap_page *pc = timer->page;
+  if (pc) {
+    uint32_t seq;
+    uint64_t count;
+    do {
+      seq = pc->lock;
+      __asm__ volatile("" ::: "memory");
+      const uint32_t idx = pc->index;
+      count = (uint64_t)pc->offset;
+      if (idx) {
+        const unsigned shift = 64U - pc->pmc_width;
+        const uint64_t pmc = arch_rdpmc(idx - 1) << shift;
+        count += (uint64_t)((int64_t)pmc >> shift);
+      }
+      __asm__ volatile("" ::: "memory");
+    } while (pc->lock != seq);
+    return count;
+  }
+#endif
+
+  uint64_t count = 0;
+  if (read(timer->fd, &count, sizeof(count)) != sizeof(count)) {
+    return 0;
+  }
+  return count;
+}
+
+static inline uint64_t arch_timer_begin(const struct timer *timer) {
+  switch (timer->type) {
+#ifdef __x86_64__
+  case TIMER_LFENCE_RDTSC:
+    return arch_timestamp_lfence_begin();
+  case TIMER_RDTSCP:
+    return arch_timestamp_rdtscp();
+#endif
+  case TIMER_CLOCK_GETTIME:
+    return arch_clock_gettime();
+  case TIMER_PERF_CYCLES:
+    return arch_perf_cycles(timer);
+  default:
+    return arch_timestamp_begin();
+  }
+}
+
+static inline uint64_t arch_timer_end(const struct timer *timer) {
+  switch (timer->type) {
+#ifdef __x86_64__
+  case TIMER_LFENCE_RDTSC:
+    return arch_timestamp_lfence_end();
+  case TIMER_RDTSCP:
+    return arch_timestamp_rdtscp();
+#endif
+  case TIMER_CLOCK_GETTIME:
+    return arch_clock_gettime();
+  case TIMER_PERF_CYCLES:
+    return arch_perf_cycles(timer);
+  default:
+    return arch_timestamp_end();
+  }
+}
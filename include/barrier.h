@@ -1,6 +1,7 @@
 #pragma once
 
 #include <pthread.h>
+#include <stdint.h>
 
 #include <config.h>
 
@@ -66,3 +67,54 @@ int pthread_barrierattr_setpshared(pthread_barrierattr_t *attr, int pshared);
 #endif
 
 #endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum barrier_type {
+  BARRIER_PTHREAD,       /* pthread_barrier_t, or the fallback above */
+  BARRIER_CENTRAL,       /* sense-reversing centralized barrier */
+  BARRIER_DISSEMINATION, /* Hensgen, Finkel & Manber */
+  BARRIER_TOURNAMENT,    /* static tournament along an arrival tree */
+  NR_BARRIERS
+};
+
+struct barrier_thread;
+
+typedef struct barrier {
+  enum barrier_type type;
+  unsigned threads;
+  unsigned rounds;
+  pthread_barrier_t pthread;
+  uint32_t *count; /* central: threads yet to arrive */
+  uint32_t *sense; /* central, tournament: global sense for the release */
+  struct barrier_thread *state; /* per-thread state, one or more lines each */
+  void *memory;
+} barrier_t;
+
+/**
+ * Initialize a barrier for a fixed number of threads.
+ *
+ * The threads identify themselves with an index in [0, threads) when waiting.
+ *
+ * @param parent arrival tree for BARRIER_TOURNAMENT: parent[i] < i is the
+ *               thread collecting the arrival of thread i; parent[0] is
+ *               ignored, thread 0 is the root. If NULL, a binary tree is used.
+ * @return 0 on success
+ **/
+int barrier_init(barrier_t *barrier, const enum barrier_type type,
+                 const unsigned threads, const unsigned *parent);
+void barrier_destroy(barrier_t *barrier);
+/**
+ * Wait until all threads have arrived at the barrier.
+ *
+ * @return PTHREAD_BARRIER_SERIAL_THREAD for exactly one thread, 0 for all
+ *         others, or an error code.
+ **/
+int barrier_wait(barrier_t *barrier, const unsigned thread);
+const char *barrier_name(const enum barrier_type type);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <hwloc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* State of the caches at the start of each repetition (--cache). */
+enum cache_mode {
+  CACHE_WARM,     /* as the previous repetition left them */
+  CACHE_COLD,     /* the benchmark's data flushed or evicted */
+  CACHE_POLLUTED, /* after the pollution kernel */
+};
+
+typedef struct cache_config {
+  enum cache_mode mode;
+  /* Bytes of the eviction or pollution buffer; 0 for twice respectively
+   * once the largest data cache of the worker's CPU. */
+  size_t size;
+  unsigned line_size;
+} cache_config_t;
+
+/* The buffer of one worker, allocated and first touched by it when needed. */
+typedef struct cache_buffer {
+  uint8_t *data;
+  size_t size;
+  int opt; /* flush with the weakly ordered instruction */
+} cache_buffer_t;
+
+void cache_buffer_init(cache_buffer_t *buffer, const cache_config_t *config,
+                       hwloc_topology_t topology, hwloc_const_cpuset_t cpuset);
+void cache_buffer_free(cache_buffer_t *buffer);
+
+/**
+ * Bring the caches into the state of config->mode before a repetition, on
+ * the calling worker. Cold flushes the lines of the benchmark's arena where
+ * the architecture can, and streams through the eviction buffer otherwise,
+ * e.g. for benchmarks that keep their own allocations. Polluted runs a
+ * read-modify-write sweep over the pollution buffer.
+ **/
+void cache_prepare(const cache_config_t *config, cache_buffer_t *buffer);
+
+#ifdef __cplusplus
+}
+#endif
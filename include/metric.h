@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A derived metric compiled against a list of events. */
+struct metric;
+
+/**
+ * Compile the expression expr for the metric name.
+ *
+ * Expressions consist of numbers, +, -, *, / and parentheses. Identifiers
+ * are the events in pmcs, "ticks" for the duration of the sample in timer
+ * ticks and "ns" for the duration in nanoseconds. Event names may contain
+ * '-', '.' and ':', so subtraction has to be surrounded by spaces.
+ *
+ * @return NULL if an event is not in pmcs or expr is malformed; the reason
+ *         has been printed to stderr.
+ **/
+struct metric *metric_compile(const char *name, const char *expr,
+                              const char **pmcs, const unsigned num_pmcs);
+void metric_free(struct metric *metric);
+const char *metric_name(const struct metric *metric);
+
+/**
+ * Evaluate metric for one sample, laid out as in the results: the duration
+ * in timer ticks followed by the counter values in the order of pmcs.
+ *
+ * @return NAN if an event was not counted or a division by zero occurred
+ **/
+double metric_eval(const struct metric *metric, const uint64_t *sample,
+                   const double ns_per_tick);
+
+/* Expression of the built-in metric name, NULL if there is none. */
+const char *metric_builtin(const char *name);
+/* Whether all events of the built-in metric name are in pmcs. */
+int metric_builtin_available(const char *name, const char **pmcs,
+                             const unsigned num_pmcs);
+/* Built-in metrics by index, NULL past the end. */
+const char *metric_builtin_idx(const unsigned idx);
+void list_metrics(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Counters of one thread; layout private to the backend. */
+struct pmu;
+
+/* Value of an event that was not counted in a repetition. */
+#define PMU_NOT_COUNTED UINT64_MAX
+
+/* How to count more events than the PMU has counters; perf backend only. */
+typedef struct pmu_config {
+  unsigned group_size; /* most events per group; 0: as many as fit */
+  int rotate; /* count one group per repetition instead of time-slicing */
+} pmu_config_t;
+
+/**
+ * A method to program and read performance counters, selected at runtime
+ * with --pmu-backend.
+ *
+ * init() runs on the measuring thread after it has been bound to cpu. The
+ * counter values of a repetition are written to data[] in the order of pmcs
+ * by end(); begin() may use the same slots for intermediate values.
+ **/
+typedef struct pmu_backend {
+  const char *const name;
+  struct pmu *(*init)(const char **pmcs, const unsigned num_pmcs,
+                      const unsigned cpu, const pmu_config_t *config);
+  void (*free)(struct pmu *pmu);
+  void (*begin)(struct pmu *pmu, uint64_t *data);
+  void (*end)(struct pmu *pmu, uint64_t *data);
+} pmu_backend_t;
+
+/* The best backend compiled in for this platform and kernel. */
+const pmu_backend_t *get_pmu_backend_default(void);
+/* NULL if there is no backend called name. */
+const pmu_backend_t *get_pmu_backend_name(const char *const name);
+void list_pmu_backends(void);
+
+/* Backends; which ones are compiled in depends on the platform. */
+extern const pmu_backend_t none_pmu;
+extern const pmu_backend_t arch_pmu;    /* native, arch.h */
+extern const pmu_backend_t perf_pmu;    /* Linux perf_event_open(2) */
+extern const pmu_backend_t jevents_pmu; /* x86_64 libjevents rdpmc */
+extern const pmu_backend_t rawmsr_pmu;  /* x86_64 /dev/cpu/N/msr */
+
+#ifdef __linux__
+/**
+ * Translate an event name into a perf_event_attr.
+ *
+ * Understands the generic perf event names (cycles, instructions, ...), raw
+ * event codes written as rXXXX (hex, as with perf) and, if libjevents is
+ * available, its event names.
+ *
+ * @return 0 on success, -1 if the event is unknown
+ **/
+int perf_event_parse(const char *const name, struct perf_event_attr *attr);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
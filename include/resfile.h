@@ -0,0 +1,142 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Binary result files (--format=binary).
+ *
+ * A header with the run's metadata is followed by one block per benchmark.
+ * A block stores one column per thread and counter (the duration is counter
+ * 0) plus, if recorded, one with the start timestamps. Each column holds the
+ * repetitions of its thread as the zigzag-encoded difference to the previous
+ * value in LEB128 varints, and can be read from the mapped file without
+ * decoding the rest. A thread may have completed fewer repetitions than the
+ * block has. All fields are native endian and aligned to 8 bytes.
+ */
+
+#define RESFILE_VERSION 1
+
+/* Column index of the start timestamps of a thread. */
+#define RESFILE_STARTS UINT32_MAX
+
+/**
+ * Write the header of a result file.
+ *
+ * @param timer_frequency ticks per second of the durations
+ * @param tsc_frequency   ticks per second of the start timestamps
+ * @param topology        hwloc XML export of the machine, may be NULL
+ **/
+void resfile_write_header(FILE *file, const double timer_frequency,
+                          const double tsc_frequency, const char *timer,
+                          const char *cpuset, const char **pmcs,
+                          const unsigned num_pmcs, const char *topology);
+
+/**
+ * Append the results of a benchmark.
+ *
+ * @param completed repetitions each thread has run, at most repetitions;
+ *                  NULL if all of them
+ * @param data      the samples as laid out by result_alloc(): per thread,
+ *                  per repetition, counters values with the duration first
+ * @param starts    start timestamps per thread and repetition, or NULL
+ **/
+void resfile_write_block(FILE *file, const char *name, const unsigned threads,
+                         const unsigned repetitions, const unsigned counters,
+                         const int *cpus, const unsigned *completed,
+                         const uint64_t *data, const uint64_t *starts);
+
+/* A result file mapped into memory; strings point into the mapping. */
+typedef struct resfile {
+  const uint8_t *map;
+  size_t size;
+  size_t blocks; /* offset of the first block */
+  double timer_frequency;
+  double tsc_frequency;
+  const char *timer;
+  const char *cpuset;
+  const char *topology;
+  unsigned num_pmcs;
+  const char **pmcs;
+} resfile_t;
+
+typedef struct resfile_block {
+  const char *name;
+  unsigned threads;
+  unsigned repetitions; /* at most, per thread */
+  unsigned counters;    /* including the duration */
+  int has_starts;
+  const int32_t *cpus;     /* one per thread */
+  const uint64_t *offsets; /* of each column into data, plus the end */
+  const uint8_t *data;
+} resfile_block_t;
+
+/* Decodes one column on the fly. */
+typedef struct resfile_column {
+  const uint8_t *pos;
+  const uint8_t *end;
+  uint64_t value;
+  unsigned remaining;
+} resfile_column_t;
+
+/**
+ * Map the result file at path.
+ *
+ * @return 0 on success, -1 if it cannot be read or is no result file; the
+ *         reason has been printed to stderr.
+ **/
+int resfile_open(resfile_t *file, const char *path);
+void resfile_close(resfile_t *file);
+
+/**
+ * Iterate over the blocks of file. Start with *cursor = 0.
+ *
+ * @return 1 if block has been filled in, 0 at the end, -1 if the file is
+ *         truncated or corrupt
+ **/
+int resfile_next_block(const resfile_t *file, size_t *cursor,
+                       resfile_block_t *block);
+
+/**
+ * Start reading a column of thread: a counter index or RESFILE_STARTS.
+ *
+ * @return 0 on success, -1 if the block has no such column
+ **/
+int resfile_column(const resfile_block_t *block, const unsigned thread,
+                   const unsigned column, resfile_column_t *it);
+
+/**
+ * Decode the value of the next repetition.
+ *
+ * @return 1 if value has been set, 0 after the last repetition of the
+ *         thread
+ **/
+static inline int resfile_column_next(resfile_column_t *it, uint64_t *value) {
+  if (it->remaining == 0 || it->pos >= it->end) {
+    return 0;
+  }
+
+  uint64_t zigzag = 0;
+  unsigned shift = 0;
+  uint8_t byte;
+  do {
+    byte = *it->pos++;
+    zigzag |= (uint64_t)(byte & 0x7f) << shift;
+    shift += 7;
+  } while ((byte & 0x80) && it->pos < it->end && shift < 64);
+
+  const uint64_t delta = (zigzag >> 1) ^ (~(zigzag & 1) + 1);
+  it->value += delta;
+  --it->remaining;
+  *value = it->value;
+  return 1;
+}
+
+#ifdef __cplusplus
+}
+#endif
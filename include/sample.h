@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* What to sample; sampling is off if period is 0. */
+typedef struct sample_config {
+  uint64_t period; /* events between two samples */
+  const char *event; /* perf event name; NULL: cycles, else cpu-clock */
+} sample_config_t;
+
+/* How often an instruction address was sampled. */
+typedef struct sample_ip {
+  uint64_t ip;
+  uint64_t count;
+} sample_ip_t;
+
+/* Samples of one repetition of one thread, sorted by address. */
+typedef struct sample_hist {
+  sample_ip_t *ips;
+  unsigned num_ips;
+  uint64_t samples;
+  uint64_t lost; /* samples the kernel dropped because the buffer was full */
+} sample_hist_t;
+
+/* A sampling event with its ring buffer on the calling thread. */
+struct sampler;
+
+/**
+ * Open the sampling event for the calling thread, which is bound to cpu.
+ * Exits if the event cannot be opened.
+ **/
+struct sampler *sampler_open(const sample_config_t *config,
+                             const unsigned cpu);
+void sampler_close(struct sampler *sampler);
+
+/* Start and stop sampling around the timed region; no processing. */
+void sampler_begin(struct sampler *sampler);
+void sampler_end(struct sampler *sampler);
+
+/**
+ * Empty the ring buffer into hist. Call after sampler_end(), outside the
+ * timed region.
+ **/
+void sampler_drain(struct sampler *sampler, sample_hist_t *hist);
+
+void sample_hist_free(sample_hist_t *hist);
+
+/**
+ * Merge the histograms src into dst, e.g. all repetitions of a thread.
+ **/
+void sample_hist_merge(sample_hist_t *dst, const sample_hist_t *src);
+
+/**
+ * Print the top most sampled addresses of hist on one line, as
+ * "address symbol+offset count", most frequent first.
+ **/
+void sample_hist_print(FILE *file, const sample_hist_t *hist,
+                       const unsigned top);
+
+#ifdef __cplusplus
+}
+#endif
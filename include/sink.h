@@ -0,0 +1,65 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <hwloc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Single-producer/single-consumer ring of samples from one worker. A record
+ * is the repetition, its start timestamp (0 if not recorded), the duration
+ * and the counter values.
+ **/
+typedef struct sink_ring {
+  uint64_t head __attribute__((aligned(64))); /* next record the worker writes */
+  uint64_t tail __attribute__((aligned(64))); /* next record the writer reads */
+  uint64_t *records __attribute__((aligned(64)));
+  unsigned capacity; /* records */
+  unsigned width;    /* uint64_t per record */
+  uint64_t waits;    /* pushes that found the ring full */
+  int cpu;
+} sink_ring_t;
+
+/* Rings of all workers of a run, drained by a writer thread. */
+typedef struct sink {
+  FILE *file;
+  sink_ring_t *rings;
+  unsigned threads;
+  double ns_per_tick; /* if non-zero, print durations in ns */
+  int closing;
+  pthread_t writer;
+  hwloc_topology_t topology;
+  hwloc_cpuset_t writer_cpuset; /* CPUs not measured, or NULL */
+} sink_t;
+
+/**
+ * Allocate a ring per thread and start the writer thread, which appends a
+ * line "cpu rep start duration counters..." to file for every record and
+ * flushes after each pass, so the output survives a crash.
+ *
+ * @param cpus        CPU of each thread, for the output
+ * @param num_counters counters per sample including the duration
+ * @param runset      the writer runs on other CPUs, if there are any
+ **/
+sink_t *sink_open(FILE *file, const unsigned threads, const int *cpus,
+                  const unsigned num_counters, const double ns_per_tick,
+                  hwloc_topology_t topology, hwloc_const_cpuset_t runset);
+
+/* Drain all rings, stop the writer and free the sink. */
+void sink_close(sink_t *sink);
+
+/**
+ * Append a sample of repetition rep; waits for the writer if the ring is
+ * full. sample holds the duration followed by the counters.
+ **/
+void sink_push(sink_ring_t *ring, const unsigned rep, const uint64_t start,
+               const uint64_t *sample);
+
+#ifdef __cplusplus
+}
+#endif
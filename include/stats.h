@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Log-linear histogram for quantiles: values below 2 * STATS_SUB_BUCKETS are
+ * counted exactly, larger ones in STATS_SUB_BUCKETS buckets per power of
+ * two, i.e. with a relative error below 1 / STATS_SUB_BUCKETS.
+ */
+#define STATS_SUB_BUCKET_BITS 7
+#define STATS_SUB_BUCKETS (1U << STATS_SUB_BUCKET_BITS)
+#define STATS_BUCKETS ((65U - STATS_SUB_BUCKET_BITS) * STATS_SUB_BUCKETS)
+
+/**
+ * Running statistics of a series of values in constant memory: count, mean
+ * and variance (Welford), minimum, maximum and a quantile histogram. Two of
+ * them can be merged, e.g. the threads of a run.
+ **/
+typedef struct online_stats {
+  uint64_t count;
+  double mean;
+  double m2; /* sum of squared differences from the mean */
+  uint64_t min;
+  uint64_t max;
+  uint64_t *buckets; /* STATS_BUCKETS */
+} online_stats_t;
+
+typedef struct stats_summary {
+  uint64_t count;
+  double mean;
+  double stddev;
+  double cv; /* coefficient of variation: stddev / mean */
+  uint64_t min;
+  uint64_t p50;
+  uint64_t p99;
+  uint64_t p999;
+  uint64_t max;
+} stats_summary_t;
+
+void stats_init(online_stats_t *stats);
+void stats_free(online_stats_t *stats);
+void stats_add(online_stats_t *stats, const uint64_t value);
+/* Add the values of src to dst. */
+void stats_merge(online_stats_t *dst, const online_stats_t *src);
+/* Smallest value with at least q * count values at or below it. */
+uint64_t stats_quantile(const online_stats_t *stats, const double q);
+void stats_summarize(const online_stats_t *stats, stats_summary_t *summary);
+
+/**
+ * Repetitions to discard before a thread's samples are kept: at least min
+ * and at most max, ending early once the durations of the last window
+ * repetitions have a coefficient of variation below cv. A window of 0 gives
+ * a fixed warm-up of min repetitions.
+ **/
+typedef struct warmup_config {
+  unsigned min;
+  unsigned max;
+  unsigned window;
+  double cv;
+} warmup_config_t;
+
+/* Sliding window over the most recent durations. */
+typedef struct steady {
+  uint64_t *values;
+  unsigned size;
+  unsigned count; /* values added so far */
+  double cv;
+} steady_t;
+
+void steady_init(steady_t *steady, const unsigned window, const double cv);
+void steady_free(steady_t *steady);
+/* Add value; non-zero if the window is full and varies by less than cv. */
+int steady_add(steady_t *steady, const uint64_t value);
+
+/* Durations kept sorted, for the confidence interval of their median. */
+typedef struct median_ci {
+  uint64_t *sorted;
+  unsigned count;
+  unsigned capacity;
+} median_ci_t;
+
+void median_ci_init(median_ci_t *ci, const unsigned capacity);
+void median_ci_free(median_ci_t *ci);
+void median_ci_add(median_ci_t *ci, const uint64_t value);
+/**
+ * Half the width of the distribution-free 95% confidence interval of the
+ * median, from the order statistics around it, relative to the median.
+ *
+ * @return INFINITY if there are too few values for the interval
+ **/
+double median_ci_width(const median_ci_t *ci);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* How the duration of a repetition is measured. */
+enum timer_type {
+  TIMER_ARCH,          /* arch_timestamp_*(); CPUID;RDTSC .. RDTSCP;CPUID */
+  TIMER_LFENCE_RDTSC,  /* LFENCE;RDTSC;LFENCE .. LFENCE;RDTSC */
+  TIMER_RDTSCP,        /* RDTSCP .. RDTSCP; waits for earlier instructions */
+  TIMER_CLOCK_GETTIME, /* clock_gettime(CLOCK_MONOTONIC_RAW), in ns */
+  TIMER_PERF_CYCLES,   /* perf_event core cycles of the calling thread */
+  NR_TIMERS
+};
+
+struct perf_event_mmap_page;
+
+/* Per-thread state of a timer; read with arch_timer_begin()/_end(). */
+struct timer {
+  enum timer_type type;
+  int fd; /* TIMER_PERF_CYCLES: perf_event, or -1 */
+  struct perf_event_mmap_page *page; /* for reads with rdpmc, or NULL */
+  uint64_t overhead; /* smallest duration of an empty measurement, in ticks */
+};
+
+/**
+ * Set up a timer of timer->type for the calling thread and measure its
+ * overhead. Exits if the timer is not available.
+ **/
+void timer_init(struct timer *timer);
+void timer_free(struct timer *timer);
+const char *timer_name(const enum timer_type type);
+
+/**
+ * Ticks per second of the timer. Constant-rate counters are measured against
+ * the system clock; for TIMER_PERF_CYCLES it is the core frequency during
+ * the measurement, on the calling thread.
+ **/
+double timer_frequency(struct timer *timer);
+
+/* Duration between start and end without the overhead of the timer. */
+static inline uint64_t timer_elapsed(const struct timer *timer,
+                                     const uint64_t start, const uint64_t end) {
+  const uint64_t elapsed = end - start;
+  return (elapsed > timer->overhead) ? elapsed - timer->overhead : 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <worker.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Frequency of arch_timestamp_begin()/arch_timestamp_end() in ticks per
+ * second. Measured once against the system clock on first use.
+ **/
+double tsc_frequency(void);
+
+/**
+ * Measure the offset of each worker's timestamp counter to the dirigent's.
+ *
+ * The dirigent and each worker in turn ping-pong a shared cache line and
+ * timestamp each hop; the round trip with the smallest latency bounds the
+ * error. Both directions are measured to cancel asymmetric latencies.
+ *
+ * @return array with one entry per worker, indexed like workers->threads:
+ *         the worker's counter reads offsets[i] ticks ahead of the dirigent's.
+ **/
+int64_t *tsc_offsets(threads_t *workers);
+
+/**
+ * Measure the offsets between all pairs of workers and print the skew matrix
+ * to stderr, with the largest skew and the largest round trip, which bounds
+ * the measurement error.
+ *
+ * @param offsets if not NULL, the result of tsc_offsets(); additionally
+ *                reports how far correcting two workers' timestamps via the
+ *                dirigent deviates from their direct offset.
+ **/
+void tsc_report(threads_t *workers, const int64_t *offsets);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <hwloc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Cache of --auto tunings: a text file with one line of tab separated
+ * fields per tuning, the key followed by the rounds. Later lines win.
+ */
+
+typedef struct tune_key {
+  const char *host;
+  const char *cpu_model;
+  const char *benchmark;
+  const char *args; /* its own arguments besides the rounds, e.g. a kernel */
+  uint64_t size;
+  double fill;
+  const char *cpuset; /* of the workers, tuned concurrently */
+  double time;      /* target seconds per repetition */
+  const char *core; /* which core chose the rounds */
+  uint64_t build;   /* hash of the compiler and its flags */
+} tune_key_t;
+
+/**
+ * Fill in the host, CPU model and build of key. The host name is static, the
+ * model belongs to topology.
+ **/
+void tunedb_key(tune_key_t *key, hwloc_topology_t topology);
+
+/* The default database: $XDG_CACHE_HOME or ~/.cache, or NULL. */
+char *tunedb_default_path(void);
+
+/* @return 0 and set rounds if path has a tuning for key, else -1 */
+int tunedb_lookup(const char *path, const tune_key_t *key, unsigned *rounds);
+void tunedb_store(const char *path, const tune_key_t *key,
+                  const unsigned rounds);
+
+#ifdef __cplusplus
+}
+#endif
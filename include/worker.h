@@ -6,33 +6,89 @@
 
 #include <barrier.h>
 #include <benchmark.h>
+#include <cache.h>
+#include <pmu.h>
+#include <sample.h>
+#include <sink.h>
+#include <stats.h>
+#include <timer.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 typedef struct work {
-  pthread_barrier_t *barrier;
+  barrier_t *barrier;
   benchmark_t *ops;
   void *arg;
   uint64_t *result;
   unsigned reps;
   const char **pmcs;
   unsigned num_pmcs;
+  unsigned thread;  /* index of this thread in the step, for the barrier */
+  uint64_t release; /* timestamp when this thread left the barrier */
+  int lockstep;     /* pass the barrier before every repetition */
+  uint64_t *starts; /* start timestamp of each repetition, or NULL */
+  /* Deadline mode: thread 0 publishes start timestamps in its clock, which
+   * everybody translates into their own clock with offset. NULL if off. */
+  uint64_t *deadlines; /* one per repetition */
+  uint64_t lead;       /* ticks from publishing a deadline to the deadline */
+  uint64_t period;     /* ticks between repetition starts, or 0 */
+  int64_t offset;      /* of this thread's clock to thread 0's */
+  int correct; /* record release and starts in thread 0's clock via offset */
+  sample_hist_t *samples; /* IP histogram of each repetition, or NULL */
+  /* Push every sample here; result and starts then only hold the current
+   * repetition. NULL to keep all of them. */
+  sink_ring_t *sink;
+  /* Accumulate the duration and each counter here instead of keeping all
+   * repetitions, and summarize them at the end. NULL if off. */
+  online_stats_t *stats;
+  stats_summary_t *summaries;
+  /* Repetitions to run before reps are kept, or NULL. Set to the number
+   * discarded when done. */
+  const warmup_config_t *warmup;
+  unsigned warmed_up;
+  /* Stop after min_reps once the median duration's 95% confidence interval
+   * is within +-ci of it; reps is the maximum then. 0 to run all reps. Set
+   * completed to the repetitions kept and ci_width to the final interval. */
+  double ci;
+  unsigned min_reps;
+  unsigned completed;
+  double ci_width;
+  /* Flush or pollute the caches before every repetition, or NULL. */
+  const cache_config_t *cache;
 } work_t;
 
 enum state { IDLE, QUEUED, WORKING, DONE };
 
+/* How the dirigent and a worker wait for each other on the mailbox. */
+enum wait_policy {
+  WAIT_SPIN,       /* busy-poll the mailbox */
+  WAIT_SPIN_FUTEX, /* busy-poll for a while, then sleep in the kernel */
+  WAIT_CONDVAR,    /* pthread_mutex_t + pthread_cond_t */
+  NR_WAIT_POLICIES
+};
+
 struct arg {
   hwloc_topology_t topology;
   hwloc_const_cpuset_t cpuset;
   char *cpuset_string;
-  pthread_mutex_t lock;
+  pthread_mutex_t lock; /* thread setup; mailbox only with WAIT_CONDVAR */
   pthread_cond_t cv;
+  /* Single-producer/single-consumer mailbox: the dirigent queues work and
+   * collects it when done, the worker picks it up and returns it. work is
+   * published by the release-store to s and read after the acquire-load. */
   work_t *work;
+  uint32_t s;        /* enum state; 32 bit wide for futex(2) */
+  uint32_t sleepers; /* threads blocked in futex(2) on s */
+  enum wait_policy wait;
+  struct timer timer; /* measures the repetitions of this thread */
+  cache_buffer_t cache; /* of --cache, allocated on first use */
+  const pmu_backend_t *pmu;
+  const pmu_config_t *pmu_config;
+  const sample_config_t *sample_config;
   unsigned thread;
   unsigned cpu;
-  enum state s;
   char run;       /* set to 0 if the thread should exit its runloop */
   char init;      /* thread binding has been done already; for dirigent */
   short dirigent; /* non-zero for dirigent; zero for worker thread */
@@ -47,21 +103,41 @@ typedef struct thread_data {
 typedef struct threads {
   thread_data_t *threads;
   hwloc_const_cpuset_t cpuset;
+  enum barrier_type barrier;
+  int lockstep; /* start every repetition of parallel runs together */
+  int deadline; /* start at a deadline published by the dirigent */
+  uint64_t lead;
+  uint64_t period;
+  int64_t *offsets; /* clock offsets to the dirigent, or NULL */
+  int correct;      /* translate recorded timestamps with offsets */
+  int sampling;     /* record IP histograms per repetition */
+  sink_t *sink; /* write results while running, or NULL */
+  int online;   /* keep running statistics instead of all samples */
+  const warmup_config_t *warmup; /* discard warm-up repetitions, or NULL */
+  double ci;         /* stop threads early at this median CI, or 0 */
+  unsigned min_reps; /* at least this many repetitions with ci */
+  const cache_config_t *cache; /* cache state before repetitions, or NULL */
 } threads_t;
 
 typedef struct step {
-  pthread_barrier_t barrier;
+  barrier_t barrier;
   struct work *work;
+  uint64_t *deadlines;
   int threads;
   int padding__;
 } step_t;
 
 void *worker(void *arg_);
 
-step_t *init_step(const int threads);
+step_t *init_step(const int threads, const enum barrier_type type,
+                  const thread_data_t *participants);
 void free_step(step_t *step);
+void step_synchronize(step_t *step, const threads_t *workers,
+                      const unsigned reps);
+uint64_t step_release_skew(const step_t *step);
 void queue_work(struct arg *arg, work_t *work);
 work_t * wait_until_done(struct arg *arg);
+const char *wait_policy_name(const enum wait_policy policy);
 
 #ifdef __cplusplus
 }
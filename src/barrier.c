@@ -1,5 +1,10 @@
+#include <assert.h>
 #include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "arch.h"
 #include "barrier.h"
 
 #ifndef HAVE_PTHREAD_BARRIER_T
@@ -86,3 +91,194 @@ int pthread_barrier_wait(pthread_barrier_t *barrier) {
 #endif
 
 #endif
+
+/* Large enough for 64 byte (x86), 128 byte (POWER) and 256 byte (A64FX)
+ * cache lines. */
+#define BARRIER_LINE 256
+/* Rounds of the dissemination barrier; enough for 2^32 threads. */
+#define BARRIER_MAX_ROUNDS 32
+
+struct barrier_thread {
+  uint32_t sense;    /* local sense */
+  uint32_t parity;   /* dissemination: flag set to use */
+  uint32_t children; /* tournament: threads reporting to this one */
+  uint32_t arrived;  /* tournament: children arrived so far */
+  unsigned parent;   /* tournament: thread this one reports to */
+  uint32_t flags[2][BARRIER_MAX_ROUNDS]; /* dissemination */
+};
+
+/* Per-thread state is padded to full lines, so that threads spin on their
+ * own lines only. */
+static const size_t thread_stride =
+    (sizeof(struct barrier_thread) + BARRIER_LINE - 1) / BARRIER_LINE *
+    BARRIER_LINE;
+
+static inline struct barrier_thread *thread_state(barrier_t *barrier,
+                                                  const unsigned thread) {
+  return (struct barrier_thread *)((char *)barrier->state +
+                                   thread * thread_stride);
+}
+
+static inline uint32_t load_acquire(const uint32_t *ptr) {
+  return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline void store_release(uint32_t *ptr, const uint32_t value) {
+  __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+static inline void spin_until(const uint32_t *ptr, const uint32_t value) {
+  while (load_acquire(ptr) != value) {
+    arch_relax();
+  }
+}
+
+const char *barrier_name(const enum barrier_type type) {
+  switch (type) {
+  case BARRIER_PTHREAD:
+    return "pthread";
+  case BARRIER_CENTRAL:
+    return "central";
+  case BARRIER_DISSEMINATION:
+    return "dissemination";
+  case BARRIER_TOURNAMENT:
+    return "tournament";
+  case NR_BARRIERS:
+    break;
+  }
+  return "unknown";
+}
+
+int barrier_init(barrier_t *barrier, const enum barrier_type type,
+                 const unsigned threads, const unsigned *parent) {
+  if (threads == 0 || type >= NR_BARRIERS) {
+    return EINVAL;
+  }
+
+  memset(barrier, 0, sizeof(*barrier));
+  barrier->type = type;
+  barrier->threads = threads;
+
+  if (type == BARRIER_PTHREAD) {
+    return pthread_barrier_init(&barrier->pthread, NULL, threads);
+  }
+
+  for (barrier->rounds = 0; (1UL << barrier->rounds) < threads;
+       ++barrier->rounds)
+    ;
+
+  /* line 0: count, line 1: sense, thereafter per-thread state */
+  const size_t size = 2 * BARRIER_LINE + threads * thread_stride;
+  if (posix_memalign(&barrier->memory, BARRIER_LINE, size)) {
+    return ENOMEM;
+  }
+  memset(barrier->memory, 0, size);
+
+  barrier->count = (uint32_t *)barrier->memory;
+  barrier->sense = (uint32_t *)((char *)barrier->memory + BARRIER_LINE);
+  barrier->state =
+      (struct barrier_thread *)((char *)barrier->memory + 2 * BARRIER_LINE);
+
+  *barrier->count = threads;
+  for (unsigned i = 0; i < threads; ++i) {
+    struct barrier_thread *self = thread_state(barrier, i);
+    self->parent = (i == 0) ? 0 : (parent ? parent[i] : (i - 1) / 2);
+    if (self->parent >= i && i > 0) {
+      free(barrier->memory);
+      return EINVAL;
+    }
+    if (i > 0) {
+      thread_state(barrier, self->parent)->children++;
+    }
+  }
+
+  return 0;
+}
+
+void barrier_destroy(barrier_t *barrier) {
+  if (barrier->type == BARRIER_PTHREAD) {
+    pthread_barrier_destroy(&barrier->pthread);
+  } else {
+    free(barrier->memory);
+  }
+}
+
+static int central_wait(barrier_t *barrier, struct barrier_thread *self) {
+  const uint32_t sense = !self->sense;
+  self->sense = sense;
+
+  if (__atomic_sub_fetch(barrier->count, 1, __ATOMIC_ACQ_REL) == 0) {
+    __atomic_store_n(barrier->count, barrier->threads, __ATOMIC_RELAXED);
+    store_release(barrier->sense, sense);
+    return PTHREAD_BARRIER_SERIAL_THREAD;
+  }
+
+  spin_until(barrier->sense, sense);
+  return 0;
+}
+
+static int dissemination_wait(barrier_t *barrier, const unsigned thread) {
+  struct barrier_thread *self = thread_state(barrier, thread);
+  /* flags are zero-initialized; the first episode waits for "1". */
+  const uint32_t sense = !self->sense;
+  const uint32_t parity = self->parity;
+
+  for (unsigned round = 0; round < barrier->rounds; ++round) {
+    const unsigned partner =
+        (unsigned)((thread + (1UL << round)) % barrier->threads);
+    store_release(&thread_state(barrier, partner)->flags[parity][round],
+                  sense);
+    spin_until(&self->flags[parity][round], sense);
+  }
+
+  /* Alternating flag sets allow a fast thread to enter the next episode
+   * while slow partners still read this one. The sense changes every
+   * other episode, when a flag set is reused. */
+  if (parity) {
+    self->sense = sense;
+  }
+  self->parity = !parity;
+
+  return (thread == 0) ? PTHREAD_BARRIER_SERIAL_THREAD : 0;
+}
+
+static int tournament_wait(barrier_t *barrier, const unsigned thread) {
+  struct barrier_thread *self = thread_state(barrier, thread);
+  const uint32_t sense = !self->sense;
+  self->sense = sense;
+
+  spin_until(&self->arrived, self->children);
+  /* Children cannot arrive again before the release below. */
+  __atomic_store_n(&self->arrived, 0, __ATOMIC_RELAXED);
+
+  if (thread == 0) {
+    /* Release everybody through a single line instead of down the tree:
+     * all waiters observe the store at about the same time. */
+    store_release(barrier->sense, sense);
+    return PTHREAD_BARRIER_SERIAL_THREAD;
+  }
+
+  __atomic_add_fetch(&thread_state(barrier, self->parent)->arrived, 1,
+                     __ATOMIC_ACQ_REL);
+  spin_until(barrier->sense, sense);
+  return 0;
+}
+
+int barrier_wait(barrier_t *barrier, const unsigned thread) {
+  assert(thread < barrier->threads);
+
+  switch (barrier->type) {
+  case BARRIER_PTHREAD:
+    return pthread_barrier_wait(&barrier->pthread);
+  case BARRIER_CENTRAL:
+    return central_wait(barrier, thread_state(barrier, thread));
+  case BARRIER_DISSEMINATION:
+    return dissemination_wait(barrier, thread);
+  case BARRIER_TOURNAMENT:
+    return tournament_wait(barrier, thread);
+  case NR_BARRIERS:
+    break;
+  }
+
+  return EINVAL;
+}
@@ -66,6 +66,7 @@ static p3f_t Step10_orig(const unsigned count1, const float xxi,
 #include <string.h>
 
 #include "HACCmk.h"
+#include "alloc.h"
 
 // TODO: clear cache after each run?
 static unsigned int N = 15000; /* Vector length, must be divisible by 4 */
@@ -135,20 +136,13 @@ static void *HACCmk_argument_init(void *arg_) {
   HACCmk_args_t *arg = (HACCmk_args_t *)malloc(sizeof(HACCmk_args_t));
 
   const size_t size = N * sizeof(float);
-  arg->xx = (float *)malloc(size);
-  arg->yy = (float *)malloc(size);
-  arg->zz = (float *)malloc(size);
-  arg->mass = (float *)malloc(size);
-  arg->vx1 = (float *)malloc(size);
-  arg->vy1 = (float *)malloc(size);
-  arg->vz1 = (float *)malloc(size);
-
-  if (arg->xx == NULL || arg->yy == NULL || arg->zz == NULL ||
-      arg->mass == NULL || arg->vx1 == NULL || arg->vy1 == NULL ||
-      arg->vz1 == NULL) {
-    fprintf(stderr, "Error allocating memory\n");
-    exit(EXIT_FAILURE);
-  }
+  arg->xx = (float *)benchmark_alloc(size);
+  arg->yy = (float *)benchmark_alloc(size);
+  arg->zz = (float *)benchmark_alloc(size);
+  arg->mass = (float *)benchmark_alloc(size);
+  arg->vx1 = (float *)benchmark_alloc(size);
+  arg->vy1 = (float *)benchmark_alloc(size);
+  arg->vz1 = (float *)benchmark_alloc(size);
 
   arg->xx[0] = 0.f;
   arg->yy[0] = 0.f;
@@ -160,13 +154,14 @@ static void *HACCmk_argument_init(void *arg_) {
 
 static void HACCmk_argument_destroy(void *arg_) {
   HACCmk_args_t *arg = (HACCmk_args_t *)arg_;
-  free(arg->xx);
-  free(arg->yy);
-  free(arg->zz);
-  free(arg->mass);
-  free(arg->vx1);
-  free(arg->vy1);
-  free(arg->vz1);
+  const size_t size = N * sizeof(float);
+  benchmark_free(arg->xx, size);
+  benchmark_free(arg->yy, size);
+  benchmark_free(arg->zz, size);
+  benchmark_free(arg->mass, size);
+  benchmark_free(arg->vx1, size);
+  benchmark_free(arg->vy1, size);
+  benchmark_free(arg->vz1, size);
 
   free(arg);
 }
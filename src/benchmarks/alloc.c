@@ -0,0 +1,573 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "alloc.h"
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+#define SIZE_2M (2UL << 20)
+#define SIZE_1G (1UL << 30)
+
+/* Smallest mapping of an arena, rounded up to the pages of --pages. */
+#define ARENA_CHUNK (256UL << 10)
+
+/* Colored chunks pick their pages from this many times as many. */
+#define COLOR_POOL 4
+
+static hwloc_topology_t topology;
+static membind_t membind = {MEMBIND_DEFAULT, 0};
+static enum page_size pages = PAGES_DEFAULT;
+static int thp_available;
+static int lock;
+static enum color_policy color_policy = COLOR_DEFAULT;
+static unsigned colors = 1; /* page colors of the last level cache */
+
+/* The NUMA node with the given OS index, or NULL. */
+static hwloc_obj_t numa_node(const unsigned os_index) {
+  hwloc_obj_t node = NULL;
+  while ((node = hwloc_get_next_obj_by_type(topology, HWLOC_OBJ_NUMANODE,
+                                            node)) != NULL) {
+    if (node->os_index == os_index) {
+      return node;
+    }
+  }
+  return NULL;
+}
+
+int benchmark_membind(hwloc_topology_t topology_, const membind_t *membind_) {
+  topology = topology_;
+  membind = *membind_;
+
+  const int nodes = hwloc_get_nbobjs_by_type(topology, HWLOC_OBJ_NUMANODE);
+  if (nodes < 1) {
+    /* No NUMA nodes known; all memory is local. */
+    membind.policy = MEMBIND_DEFAULT;
+    return 0;
+  }
+  if (membind.policy == MEMBIND_NODE && numa_node(membind.node) == NULL) {
+    fprintf(stderr, "There is no NUMA node %u.\n", membind.node);
+    return -1;
+  }
+  if (membind.policy == MEMBIND_REMOTE && nodes < 2) {
+    fprintf(stderr, "--membind=remote requires at least two NUMA nodes.\n");
+    return -1;
+  }
+  return 0;
+}
+
+void benchmark_mlock(const int lock_) { lock = lock_; }
+
+/* THP may be disabled system-wide; madvise() succeeds anyway then. */
+static int thp_enabled(void) {
+  FILE *file = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+  if (file == NULL) {
+    return 0;
+  }
+  char mode[64] = "";
+  const int ok = fgets(mode, sizeof(mode), file) != NULL;
+  fclose(file);
+  return ok && strstr(mode, "[never]") == NULL;
+}
+
+void benchmark_pages(const enum page_size pages_) {
+  pages = pages_;
+  thp_available = thp_enabled();
+}
+
+static const char *page_size_name(const enum page_size size) {
+  switch (size) {
+  case PAGES_DEFAULT:
+  case PAGES_4K:
+    return "4k";
+  case PAGES_THP:
+    return "thp";
+  case PAGES_2M:
+    return "2m";
+  case PAGES_1G:
+    return "1g";
+  }
+  return "unknown";
+}
+
+/* Report each page size obtained for a request once. */
+static void report_pages(const enum page_size obtained) {
+  static unsigned reported;
+  const unsigned bit = 1U << obtained;
+  if (__sync_fetch_and_or(&reported, bit) & bit) {
+    return;
+  }
+  if (obtained == pages) {
+    fprintf(stderr, "[Pages] benchmark data on %s pages\n",
+            page_size_name(obtained));
+  } else {
+    fprintf(stderr, "[Pages] %s pages unavailable, benchmark data on %s pages\n",
+            page_size_name(pages), page_size_name(obtained));
+  }
+}
+
+int benchmark_is_data_cache(hwloc_obj_t obj) {
+#if HWLOC_API_VERSION >= 0x00020001
+  return hwloc_obj_type_is_dcache(obj->type);
+#else
+  return obj->type == HWLOC_OBJ_CACHE &&
+         obj->attr->cache.type != HWLOC_OBJ_CACHE_INSTRUCTION;
+#endif
+}
+
+/* Set nodeset to the NUMA nodes of the CPU the calling thread runs on. */
+static void local_nodes(hwloc_nodeset_t nodeset) {
+  hwloc_cpuset_t cpuset = hwloc_bitmap_alloc();
+  if (hwloc_get_last_cpu_location(topology, cpuset, HWLOC_CPUBIND_THREAD)) {
+    hwloc_bitmap_copy(cpuset, hwloc_topology_get_topology_cpuset(topology));
+  }
+  hwloc_cpuset_to_nodeset(topology, cpuset, nodeset);
+  hwloc_bitmap_free(cpuset);
+}
+
+/* Set nodeset to the next node after the local ones, in logical order. */
+static void remote_node(hwloc_nodeset_t nodeset) {
+  hwloc_nodeset_t local = hwloc_bitmap_alloc();
+  local_nodes(local);
+  const int nodes = hwloc_get_nbobjs_by_type(topology, HWLOC_OBJ_NUMANODE);
+  hwloc_obj_t last = NULL;
+  for (int i = 0; i < nodes; ++i) {
+    hwloc_obj_t node =
+        hwloc_get_obj_by_type(topology, HWLOC_OBJ_NUMANODE, (unsigned)i);
+    if (hwloc_bitmap_isset(local, node->os_index)) {
+      last = node;
+    }
+  }
+  const unsigned next = last ? (last->logical_index + 1) % (unsigned)nodes : 0;
+  hwloc_bitmap_only(
+      nodeset,
+      hwloc_get_obj_by_type(topology, HWLOC_OBJ_NUMANODE, next)->os_index);
+  hwloc_bitmap_free(local);
+}
+
+/* Bind the pages of data to the nodes of --membind; best effort. */
+static void bind_area(void *data, const size_t size) {
+  hwloc_nodeset_t nodeset = hwloc_bitmap_alloc();
+  hwloc_membind_policy_t policy = HWLOC_MEMBIND_BIND;
+  switch (membind.policy) {
+  case MEMBIND_LOCAL:
+    local_nodes(nodeset);
+    break;
+  case MEMBIND_INTERLEAVE:
+    hwloc_bitmap_copy(nodeset, hwloc_topology_get_topology_nodeset(topology));
+    policy = HWLOC_MEMBIND_INTERLEAVE;
+    break;
+  case MEMBIND_NODE:
+    hwloc_bitmap_only(nodeset, membind.node);
+    break;
+  case MEMBIND_REMOTE:
+    remote_node(nodeset);
+    break;
+  case MEMBIND_DEFAULT:
+    hwloc_bitmap_free(nodeset);
+    return;
+  }
+#if HWLOC_API_VERSION >= 0x00020000
+  hwloc_set_area_membind(topology, data, size, nodeset, policy,
+                         HWLOC_MEMBIND_BYNODESET);
+#else
+  hwloc_set_area_membind_nodeset(topology, data, size, nodeset, policy, 0);
+#endif
+  hwloc_bitmap_free(nodeset);
+}
+
+/* First touch by the calling worker, after the binding and madvise(). */
+static void fault_in(uint8_t *data, const size_t size) {
+  const size_t base = (size_t)sysconf(_SC_PAGESIZE);
+  for (size_t offset = 0; offset < size; offset += base) {
+    ((volatile uint8_t *)data)[offset] = 0;
+  }
+}
+
+static size_t round_up(const size_t size, const size_t page) {
+  return (size + page - 1) / page * page;
+}
+
+/* A hugetlbfs mapping of size bytes, or NULL if none are reserved. */
+static void *map_hugetlb(const size_t size, const unsigned shift) {
+#ifdef MAP_HUGETLB
+  void *data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+                        (int)(shift << MAP_HUGE_SHIFT),
+                    -1, 0);
+  return (data == MAP_FAILED) ? NULL : data;
+#else
+  (void)size;
+  (void)shift;
+  return NULL;
+#endif
+}
+
+/* An anonymous mapping of size bytes aligned to align, or NULL. */
+static void *map_aligned(const size_t size, const size_t align) {
+  uint8_t *data = (uint8_t *)mmap(NULL, size + align, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (data == MAP_FAILED) {
+    return NULL;
+  }
+  const size_t head = (align - (uintptr_t)data % align) % align;
+  if (head) {
+    munmap(data, head);
+  }
+  munmap(&data[head + size], align - head);
+  return &data[head];
+}
+
+/**
+ * Map at least *size bytes on the pages of --pages, or the next smaller ones
+ * available, and round *size up to the size of the pages obtained.
+ **/
+static void *map_pages(size_t *size) {
+  void *data = NULL;
+  if (pages == PAGES_1G) {
+    data = map_hugetlb(round_up(*size, SIZE_1G), 30);
+    if (data) {
+      *size = round_up(*size, SIZE_1G);
+      report_pages(PAGES_1G);
+      return data;
+    }
+  }
+  if (pages == PAGES_1G || pages == PAGES_2M) {
+    data = map_hugetlb(round_up(*size, SIZE_2M), 21);
+    if (data) {
+      *size = round_up(*size, SIZE_2M);
+      report_pages(PAGES_2M);
+      return data;
+    }
+  }
+
+  /* Transparent huge pages need 2M aligned extents, base pages no more. */
+  const int huge = pages != PAGES_DEFAULT && pages != PAGES_4K && thp_available;
+  const size_t page = huge ? SIZE_2M : (size_t)sysconf(_SC_PAGESIZE);
+  const size_t mapped = round_up(*size, page);
+  data = map_aligned(mapped, page);
+  if (data == NULL) {
+    return NULL;
+  }
+  *size = mapped;
+#if defined(MADV_HUGEPAGE) && defined(MADV_NOHUGEPAGE)
+  if (pages != PAGES_DEFAULT) {
+    /* Explicit 4k pages exclude THP; the others fall back to them. */
+    const int thp = huge && madvise(data, mapped, MADV_HUGEPAGE) == 0;
+    if (!thp) {
+      madvise(data, mapped, MADV_NOHUGEPAGE);
+    }
+    report_pages(thp ? PAGES_THP : PAGES_4K);
+  }
+#else
+  if (pages != PAGES_DEFAULT) {
+    report_pages(PAGES_4K);
+  }
+#endif
+  return data;
+}
+
+/* Per worker, for --color-policy=random. */
+static uint64_t next_random(void) {
+  static __thread uint64_t state;
+  if (state == 0) {
+    state = ((uint64_t)time(NULL) << 16) ^ (uint64_t)(uintptr_t)&state;
+    state |= 1;
+  }
+  /* xorshift64 */
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+
+int benchmark_colors(hwloc_topology_t topology_,
+                     const enum color_policy policy) {
+  color_policy = policy;
+  if (policy == COLOR_DEFAULT) {
+    return 0;
+  }
+  if (pages != PAGES_DEFAULT && pages != PAGES_4K) {
+    fprintf(stderr, "--color-policy requires --pages=4k.\n");
+    return -1;
+  }
+
+  /* Sets of the last level cache of the first CPU, per base page. */
+  hwloc_obj_t llc = NULL;
+  hwloc_obj_t obj = hwloc_get_obj_by_type(topology_, HWLOC_OBJ_PU, 0);
+  for (; obj; obj = obj->parent) {
+    if (benchmark_is_data_cache(obj)) {
+      llc = obj;
+    }
+  }
+  const size_t base = (size_t)sysconf(_SC_PAGESIZE);
+  if (llc && llc->attr->cache.associativity > 0) {
+    const uint64_t way = llc->attr->cache.size /
+                         (unsigned)llc->attr->cache.associativity;
+    colors = (way > base) ? (unsigned)(way / base) : 1;
+    fprintf(stderr, "[Colors] %u page colors of the %" PRIu64 " byte L%u "
+                    "cache\n",
+            colors, llc->attr->cache.size, llc->attr->cache.depth);
+  } else {
+    colors = 1;
+    fprintf(stderr, "[Colors] The associativity of the last level cache is "
+                    "unknown; all pages have one color.\n");
+  }
+  return 0;
+}
+
+/**
+ * Color of each of the count base pages at pool: the physical frame number
+ * from /proc/self/pagemap, where permitted, else the virtual page number.
+ **/
+static void page_colors(const uint8_t *pool, const size_t count,
+                        unsigned *color) {
+  const size_t base = (size_t)sysconf(_SC_PAGESIZE);
+  uint64_t *entries = (uint64_t *)calloc(count, sizeof(uint64_t));
+  int physical = 0;
+  const int fd = open("/proc/self/pagemap", O_RDONLY);
+  if (entries && fd >= 0) {
+    const off_t offset = (off_t)((uintptr_t)pool / base * sizeof(uint64_t));
+    const ssize_t bytes = pread(fd, entries, count * sizeof(uint64_t), offset);
+    for (size_t i = 0; bytes == (ssize_t)(count * sizeof(uint64_t)) &&
+                       i < count;
+         ++i) {
+      /* Bit 63: present; the frame number reads as 0 without CAP_SYS_ADMIN. */
+      const uint64_t pfn = entries[i] & ((1ULL << 55) - 1);
+      physical |= (entries[i] >> 63) && pfn;
+    }
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    const uint64_t frame =
+        physical ? (entries[i] & ((1ULL << 55) - 1))
+                 : (uint64_t)((uintptr_t)&pool[i * base] / base);
+    color[i] = (unsigned)(frame % colors);
+  }
+  free(entries);
+
+  static unsigned reported;
+  const unsigned bit = physical ? 1U : 2U;
+  if ((__sync_fetch_and_or(&reported, bit) & bit) == 0) {
+    fprintf(stderr, "[Colors] %s pages by %s address\n",
+            (color_policy == COLOR_RANDOM)       ? "random"
+            : (color_policy == COLOR_CONTIGUOUS) ? "contiguous"
+                                                 : "worst",
+            physical ? "physical" : "virtual");
+  }
+}
+
+/* Pick count of the pool pages with the given colors for --color-policy. */
+static void pick_pages(const unsigned *color, const size_t pool,
+                       const size_t count, size_t *pick) {
+  /* The pool pages of each color, starting at first[c]. */
+  size_t *first = (size_t *)calloc(colors + 1, sizeof(size_t));
+  size_t *sorted = (size_t *)malloc(sizeof(size_t) * pool);
+  size_t *taken = (size_t *)calloc(colors, sizeof(size_t));
+  if (first == NULL || sorted == NULL || taken == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < pool; ++i) {
+    ++first[color[i] + 1];
+  }
+  for (unsigned c = 0; c < colors; ++c) {
+    first[c + 1] += first[c];
+  }
+  for (size_t i = 0; i < pool; ++i) {
+    sorted[first[color[i]] + taken[color[i]]++] = i;
+  }
+  memset(taken, 0, sizeof(size_t) * colors);
+
+  switch (color_policy) {
+  case COLOR_RANDOM:
+    /* Partial Fisher-Yates shuffle. */
+    for (size_t i = 0; i < count; ++i) {
+      const size_t j = i + (size_t)(next_random() % (pool - i));
+      const size_t tmp = sorted[i];
+      sorted[i] = sorted[j];
+      sorted[j] = tmp;
+      pick[i] = sorted[i];
+    }
+    break;
+  case COLOR_CONTIGUOUS:
+    /* Colors in turn, as physically contiguous memory would have them. */
+    for (size_t i = 0; i < count; ++i) {
+      unsigned c = (unsigned)(i % colors);
+      while (first[c] + taken[c] == first[c + 1]) {
+        c = (c + 1) % colors;
+      }
+      pick[i] = sorted[first[c] + taken[c]++];
+    }
+    break;
+  case COLOR_WORST:
+  case COLOR_DEFAULT:
+    /* As few colors as possible: the most frequent ones first. */
+    for (size_t i = 0; i < count;) {
+      unsigned most = 0;
+      for (unsigned c = 1; c < colors; ++c) {
+        if (first[c + 1] - first[c] - taken[c] >
+            first[most + 1] - first[most] - taken[most]) {
+          most = c;
+        }
+      }
+      for (; i < count && first[most] + taken[most] < first[most + 1]; ++i) {
+        pick[i] = sorted[first[most] + taken[most]++];
+      }
+    }
+    break;
+  }
+
+  free(taken);
+  free(sorted);
+  free(first);
+}
+
+/**
+ * Map size bytes of base pages picked by color from a pool of COLOR_POOL
+ * times as many, faulted in and bound, and moved into place with mremap().
+ **/
+static void *map_colored(const size_t size) {
+  const size_t base = (size_t)sysconf(_SC_PAGESIZE);
+  const size_t count = size / base;
+  const size_t pool_count = count * COLOR_POOL;
+  uint8_t *pool = (uint8_t *)map_aligned(pool_count * base, base);
+  uint8_t *data = (uint8_t *)mmap(NULL, size, PROT_NONE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  unsigned *color = (unsigned *)malloc(sizeof(unsigned) * pool_count);
+  size_t *pick = (size_t *)malloc(sizeof(size_t) * count);
+  if (pool == NULL || data == MAP_FAILED || color == NULL || pick == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+#ifdef MADV_NOHUGEPAGE
+  madvise(pool, pool_count * base, MADV_NOHUGEPAGE);
+#endif
+  bind_area(pool, pool_count * base);
+  fault_in(pool, pool_count * base);
+
+  page_colors(pool, pool_count, color);
+  pick_pages(color, pool_count, count, pick);
+  for (size_t i = 0; i < count; ++i) {
+    if (mremap(&pool[pick[i] * base], base, base,
+               MREMAP_MAYMOVE | MREMAP_FIXED, &data[i * base]) == MAP_FAILED) {
+      fprintf(stderr, "[Colors] mremap failed: %s; see vm.max_map_count\n",
+              strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  munmap(pool, pool_count * base);
+  free(pick);
+  free(color);
+  return data;
+}
+
+/* One mapping of a worker's arena. */
+struct chunk {
+  uint8_t *data;
+  size_t size;
+  size_t used;
+  struct chunk *next;
+};
+
+/* The chunks of the calling worker, the newest first. */
+static __thread struct chunk *arena;
+
+/* Map, bind, fault in and possibly lock a chunk of at least size bytes. */
+static struct chunk *map_chunk(const size_t size) {
+  size_t mapped = size;
+  struct chunk *chunk = (struct chunk *)malloc(sizeof(struct chunk));
+  if (chunk == NULL) {
+    return NULL;
+  }
+  if (color_policy != COLOR_DEFAULT) {
+    /* --color-policy maps base pages only. */
+    mapped = round_up(size, (size_t)sysconf(_SC_PAGESIZE));
+    chunk->data = (uint8_t *)map_colored(mapped);
+  } else {
+    chunk->data = (uint8_t *)map_pages(&mapped);
+    if (chunk->data) {
+      bind_area(chunk->data, mapped);
+      fault_in(chunk->data, mapped);
+    }
+  }
+  if (chunk->data == NULL) {
+    free(chunk);
+    return NULL;
+  }
+  chunk->size = mapped;
+  chunk->used = 0;
+  if (color_policy == COLOR_RANDOM) {
+    /* A random line of the first page; the caller has added a page. */
+    const size_t lines = (size_t)sysconf(_SC_PAGESIZE) / BENCHMARK_ALIGN;
+    chunk->used = (size_t)(next_random() % lines) * BENCHMARK_ALIGN;
+  }
+  if (lock && mlock(chunk->data, mapped)) {
+    static int reported;
+    if (__sync_lock_test_and_set(&reported, 1) == 0) {
+      fprintf(stderr, "[Pages] mlock failed: %s; benchmark data unlocked\n",
+              strerror(errno));
+    }
+  }
+
+  chunk->next = arena;
+  arena = chunk;
+  return chunk;
+}
+
+void *benchmark_alloc(const size_t size) {
+  const size_t base = (size_t)sysconf(_SC_PAGESIZE);
+  const int random = color_policy == COLOR_RANDOM;
+  const size_t align = (size >= base && !random) ? base : BENCHMARK_ALIGN;
+  struct chunk *chunk = arena;
+  size_t offset = chunk ? (chunk->used + align - 1) / align * align : 0;
+  if (chunk == NULL || offset + size > chunk->size) {
+    const size_t room = size + (random ? base : 0);
+    chunk = map_chunk((room > ARENA_CHUNK) ? room : ARENA_CHUNK);
+    offset = chunk ? chunk->used : 0;
+  }
+
+  if (chunk == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+  chunk->used = offset + size;
+  return &chunk->data[offset];
+}
+
+void benchmark_free(void *data, const size_t size) {
+  /* Released with the whole arena by benchmark_arena_reset(). */
+  (void)data;
+  (void)size;
+}
+
+void benchmark_arena_reset(void) {
+  while (arena) {
+    struct chunk *chunk = arena;
+    arena = chunk->next;
+    munmap(chunk->data, chunk->size);
+    free(chunk);
+  }
+}
+
+size_t benchmark_arena_walk(void (*visit)(void *data, const size_t size)) {
+  size_t bytes = 0;
+  for (struct chunk *chunk = arena; chunk; chunk = chunk->next) {
+    visit(chunk->data, chunk->used);
+    bytes += chunk->used;
+  }
+  return bytes;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <hwloc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Benchmark data comes from an arena per worker: mappings that are placed
+ * by --membind and --pages, faulted in by the bound worker before the first
+ * repetition and optionally locked, and released all at once when the
+ * worker tears the benchmark down.
+ */
+
+/* A cache line, and the widest SIMD registers (AVX-512). */
+#define BENCHMARK_ALIGN 64
+
+/* Non-zero if obj is a data or unified cache, with hwloc 1.x and 2.x. */
+int benchmark_is_data_cache(hwloc_obj_t obj);
+
+/* Where benchmark_alloc() places the data of a worker (--membind). */
+enum membind_policy {
+  MEMBIND_DEFAULT,    /* the kernel's policy, usually first touch */
+  MEMBIND_LOCAL,      /* the NUMA node of the worker's CPU */
+  MEMBIND_INTERLEAVE, /* page by page over all NUMA nodes */
+  MEMBIND_NODE,       /* one NUMA node for all workers */
+  MEMBIND_REMOTE,     /* the next NUMA node after the worker's */
+};
+
+typedef struct membind {
+  enum membind_policy policy;
+  unsigned node; /* OS index of the NUMA node of MEMBIND_NODE */
+} membind_t;
+
+/**
+ * Set the placement of all following benchmark_alloc() calls. Not thread
+ * safe; call before the workers set up their benchmarks.
+ *
+ * @return 0, or -1 if the policy cannot be followed on topology, e.g. there
+ *         is no such node or no remote node; the reason has been printed.
+ **/
+int benchmark_membind(hwloc_topology_t topology, const membind_t *membind);
+
+/* The pages of benchmark_alloc() (--pages). */
+enum page_size {
+  PAGES_DEFAULT, /* THP as the system's setting has it */
+  PAGES_4K,      /* base pages only, without THP */
+  PAGES_THP,     /* transparent huge pages, madvise(MADV_HUGEPAGE) */
+  PAGES_2M,      /* hugetlbfs, MAP_HUGETLB */
+  PAGES_1G,
+};
+
+/**
+ * Set the pages of all following benchmark_alloc() calls. Not thread safe.
+ * Huge pages that are unavailable fall back: 1g to 2m, 2m to thp and thp to
+ * 4k. The pages obtained are reported on stderr.
+ **/
+void benchmark_pages(const enum page_size pages);
+
+/* Page coloring of benchmark_alloc() (--color-policy). */
+enum color_policy {
+  COLOR_DEFAULT,    /* the pages the kernel hands out */
+  COLOR_RANDOM,     /* random colors, at a random line of the first page */
+  COLOR_CONTIGUOUS, /* all colors in turn, as contiguous memory */
+  COLOR_WORST,      /* as few colors as possible */
+};
+
+/**
+ * Set the page coloring of all following benchmark_alloc() calls. Not thread
+ * safe. The colors are the sets of the last level cache that a base page
+ * maps to; a chunk's pages are picked from four times as many by their
+ * physical address from /proc/self/pagemap (which needs CAP_SYS_ADMIN), else
+ * by their virtual address. Each page is a mapping of its own, so the data
+ * is limited by vm.max_map_count.
+ *
+ * @return 0, or -1 if --pages is not base pages; the reason has been printed
+ **/
+int benchmark_colors(hwloc_topology_t topology, const enum color_policy policy);
+
+/* mlock() the arenas (--mlock); a failure is reported once. */
+void benchmark_mlock(const int lock);
+
+/**
+ * Allocate size bytes of benchmark data from the calling worker's arena,
+ * aligned to a page from a page on and to BENCHMARK_ALIGN below (always to
+ * BENCHMARK_ALIGN with COLOR_RANDOM). The memory is zeroed and faulted in.
+ * Exits if there is not enough memory.
+ **/
+void *benchmark_alloc(const size_t size);
+/* Kept until benchmark_arena_reset(). */
+void benchmark_free(void *data, const size_t size);
+/* Release the calling worker's arena, after the benchmark's free_arg(). */
+void benchmark_arena_reset(void);
+/**
+ * Call visit on the allocated part of each mapping of the calling worker's
+ * arena, e.g. to flush it from the caches (--cache=cold).
+ *
+ * @return the bytes visited; 0 if the benchmark keeps its own allocations
+ **/
+size_t benchmark_arena_walk(void (*visit)(void *data, const size_t size));
+
+#ifdef __cplusplus
+}
+#endif
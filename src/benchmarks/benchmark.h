@@ -21,6 +21,8 @@ typedef struct {
   void (*free_arg)(void *args);
   void *(*call)(void *arg);
   void *state;
+  /* Floating-point operations of a call, for GFLOP/s; 0 if not counted. */
+  uint64_t flop;
 } benchmark_t;
 
 unsigned number_benchmarks(void);
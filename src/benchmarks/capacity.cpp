@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "alloc.h"
 #include "capacity.h"
 
 static unsigned size;
@@ -15,6 +16,7 @@ static unsigned num_lines;
 static unsigned rounds;
 
 class capacity {
+  const size_t bytes;
   uint8_t *data;
 
 private:
@@ -22,8 +24,9 @@ private:
   capacity &operator=(const capacity &);
 
 public:
-  capacity(const size_t size) : data(new uint8_t[size]) {}
-  ~capacity() { delete[] data; }
+  capacity(const size_t size)
+      : bytes(size), data((uint8_t *)benchmark_alloc(size)) {}
+  ~capacity() { benchmark_free(data, bytes); }
 
   void work() {
     uint8_t tmp = 0;
@@ -94,5 +97,6 @@ static void *call_work(void *arg_) {
 benchmark_t capacity_ops = {
     "capacity",       capacity_init, init_argument, NULL,
     destroy_argument, call_work,     NULL,
+    0,
 };
 
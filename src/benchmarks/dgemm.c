@@ -17,6 +17,12 @@
 #include "mkl.h"
 #endif
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define DGEMM_X86
+#endif
+
+#include "alloc.h"
 #include "dgemm.h"
 
 static void do_dgemm(
@@ -26,7 +32,8 @@ static void do_dgemm(
 		int N,
 		double alpha,
 		double beta,
-		int repeats)
+		int repeats,
+		int blas)
 {
 	int i, j, k, r;
 	// ------------------------------------------------------- //
@@ -42,15 +49,23 @@ static void do_dgemm(
 	// Repeat multiple times
 	for(r = 0; r < repeats; r++) {
 #if defined( USE_MKL ) || defined (USE_CBLAS)
+		if (blas) {
         cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
             N, N, N, alpha, matrixA, N, matrixB, N, beta, matrixC, N);
+			continue;
+		}
 #elif defined( USE_NVBLAS )
+		if (blas) {
 		char transA = 'N';
 		char transB = 'N';
 
 		dgemm(&transA, &transB, &N, &N, &N, &alpha, matrixA, &N,
 			matrixB, &N, &beta, matrixC, &N);
+			continue;
+		}
 #else
+		(void)blas;
+#endif
 //		#pragma omp parallel for private(sum)
 		for(i = 0; i < N; i++) {
 			for(j = 0; j < N; j++) {
@@ -63,7 +78,6 @@ static void do_dgemm(
 				matrixC[i*N + j] = (alpha * sum) + (beta * matrixC[i*N + j]);
 			}
 		}
-#endif
 	}
 
 	// ------------------------------------------------------- //
@@ -71,6 +85,246 @@ static void do_dgemm(
 	// ------------------------------------------------------- //
 }
 
+/*
+ * Packed, cache-blocked DGEMM in the manner of GotoBLAS/BLIS: a KC x NC block
+ * of B is packed into panels of NR columns to stay in the last level cache, an
+ * MC x KC block of A into panels of MR rows for L2, and a micro-kernel keeps an
+ * MR x NR tile of C in registers while it streams through one panel of each.
+ * Edge tiles are padded with zeros when packing and go through a scratch tile.
+ */
+
+#define DGEMM_KC 256
+#define DGEMM_MC 96  /* a multiple of every MR */
+#define DGEMM_NC 2048 /* a multiple of every NR */
+
+/* C[MR x NR], rows ldc apart, += alpha * A panel * B panel. */
+typedef void (*dgemm_ukr_t)(const int kc, const double *a, const double *b,
+                            double *c, const int ldc, const double alpha);
+
+enum dgemm_kernel {
+  DGEMM_NAIVE,   /* the i-j-k loop of HPCC */
+  DGEMM_BLOCKED, /* packed, with a portable micro-kernel */
+  DGEMM_AVX2,    /* packed, with an AVX2+FMA micro-kernel */
+  DGEMM_AVX512,  /* packed, with an AVX-512 micro-kernel */
+  DGEMM_BLAS,    /* cblas_dgemm() of the library compiled in */
+};
+
+static const char *dgemm_kernel_names[] = {"naive", "blocked", "avx2",
+                                           "avx512", "blas"};
+
+/* 4 x 4 in 128-bit vectors of the compiler: SSE2 on x86-64, NEON on ARM. */
+typedef double v2df __attribute__((vector_size(16)));
+
+static void ukr_blocked(const int kc, const double *a, const double *b,
+                        double *c, const int ldc, const double alpha) {
+  v2df c00 = {0.0, 0.0}, c01 = c00, c10 = c00, c11 = c00;
+  v2df c20 = c00, c21 = c00, c30 = c00, c31 = c00;
+  for (int k = 0; k < kc; ++k) {
+    const v2df b0 = {b[0], b[1]};
+    const v2df b1 = {b[2], b[3]};
+    v2df ai = {a[0], a[0]};
+    c00 += ai * b0;
+    c01 += ai * b1;
+    ai = (v2df){a[1], a[1]};
+    c10 += ai * b0;
+    c11 += ai * b1;
+    ai = (v2df){a[2], a[2]};
+    c20 += ai * b0;
+    c21 += ai * b1;
+    ai = (v2df){a[3], a[3]};
+    c30 += ai * b0;
+    c31 += ai * b1;
+    a += 4;
+    b += 4;
+  }
+
+  const v2df rows[4][2] = {{c00, c01}, {c10, c11}, {c20, c21}, {c30, c31}};
+  for (int i = 0; i < 4; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      c[i * ldc + j] += alpha * rows[i][j / 2][j % 2];
+    }
+  }
+}
+
+#ifdef DGEMM_X86
+/* 6 x 8: twelve accumulators, two rows of B and a broadcast of A. */
+__attribute__((target("avx2,fma"))) static void
+ukr_avx2(const int kc, const double *a, const double *b, double *c,
+         const int ldc, const double alpha) {
+  __m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+  __m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+  __m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+  __m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+  __m256d c40 = _mm256_setzero_pd(), c41 = _mm256_setzero_pd();
+  __m256d c50 = _mm256_setzero_pd(), c51 = _mm256_setzero_pd();
+  for (int k = 0; k < kc; ++k) {
+    const __m256d b0 = _mm256_load_pd(&b[0]);
+    const __m256d b1 = _mm256_load_pd(&b[4]);
+    __m256d ai = _mm256_broadcast_sd(&a[0]);
+    c00 = _mm256_fmadd_pd(ai, b0, c00);
+    c01 = _mm256_fmadd_pd(ai, b1, c01);
+    ai = _mm256_broadcast_sd(&a[1]);
+    c10 = _mm256_fmadd_pd(ai, b0, c10);
+    c11 = _mm256_fmadd_pd(ai, b1, c11);
+    ai = _mm256_broadcast_sd(&a[2]);
+    c20 = _mm256_fmadd_pd(ai, b0, c20);
+    c21 = _mm256_fmadd_pd(ai, b1, c21);
+    ai = _mm256_broadcast_sd(&a[3]);
+    c30 = _mm256_fmadd_pd(ai, b0, c30);
+    c31 = _mm256_fmadd_pd(ai, b1, c31);
+    ai = _mm256_broadcast_sd(&a[4]);
+    c40 = _mm256_fmadd_pd(ai, b0, c40);
+    c41 = _mm256_fmadd_pd(ai, b1, c41);
+    ai = _mm256_broadcast_sd(&a[5]);
+    c50 = _mm256_fmadd_pd(ai, b0, c50);
+    c51 = _mm256_fmadd_pd(ai, b1, c51);
+    a += 6;
+    b += 8;
+  }
+
+  const __m256d alpha_ = _mm256_set1_pd(alpha);
+  const __m256d rows[6][2] = {{c00, c01}, {c10, c11}, {c20, c21},
+                              {c30, c31}, {c40, c41}, {c50, c51}};
+  for (int i = 0; i < 6; ++i) {
+    double *row = &c[i * ldc];
+    _mm256_storeu_pd(&row[0], _mm256_fmadd_pd(alpha_, rows[i][0],
+                                              _mm256_loadu_pd(&row[0])));
+    _mm256_storeu_pd(&row[4], _mm256_fmadd_pd(alpha_, rows[i][1],
+                                              _mm256_loadu_pd(&row[4])));
+  }
+}
+
+/* 8 x 16: sixteen accumulators, two rows of B and a broadcast of A. */
+__attribute__((target("avx512f"))) static void
+ukr_avx512(const int kc, const double *a, const double *b, double *c,
+           const int ldc, const double alpha) {
+  __m512d acc[8][2];
+  for (int i = 0; i < 8; ++i) {
+    acc[i][0] = _mm512_setzero_pd();
+    acc[i][1] = _mm512_setzero_pd();
+  }
+  for (int k = 0; k < kc; ++k) {
+    const __m512d b0 = _mm512_load_pd(&b[0]);
+    const __m512d b1 = _mm512_load_pd(&b[8]);
+#pragma GCC unroll 8
+    for (int i = 0; i < 8; ++i) {
+      const __m512d ai = _mm512_set1_pd(a[i]);
+      acc[i][0] = _mm512_fmadd_pd(ai, b0, acc[i][0]);
+      acc[i][1] = _mm512_fmadd_pd(ai, b1, acc[i][1]);
+    }
+    a += 8;
+    b += 16;
+  }
+
+  const __m512d alpha_ = _mm512_set1_pd(alpha);
+  for (int i = 0; i < 8; ++i) {
+    double *row = &c[i * ldc];
+    _mm512_storeu_pd(&row[0], _mm512_fmadd_pd(alpha_, acc[i][0],
+                                              _mm512_loadu_pd(&row[0])));
+    _mm512_storeu_pd(&row[8], _mm512_fmadd_pd(alpha_, acc[i][1],
+                                              _mm512_loadu_pd(&row[8])));
+  }
+}
+#endif
+
+typedef struct {
+  int mr;
+  int nr;
+  dgemm_ukr_t ukr;
+} dgemm_blocking_t;
+
+static dgemm_blocking_t blocking(const enum dgemm_kernel kernel) {
+  dgemm_blocking_t b = {4, 4, ukr_blocked};
+#ifdef DGEMM_X86
+  if (kernel == DGEMM_AVX2) {
+    b.mr = 6;
+    b.nr = 8;
+    b.ukr = ukr_avx2;
+  } else if (kernel == DGEMM_AVX512) {
+    b.mr = 8;
+    b.nr = 16;
+    b.ukr = ukr_avx512;
+  }
+#else
+  (void)kernel;
+#endif
+  return b;
+}
+
+/* Rows [i, i + mc) and columns [p, p + kc) of A in panels of mr rows. */
+static void pack_a(const double *A, const int N, const int i, const int p,
+                   const int mc, const int kc, const int mr, double *packed) {
+  for (int panel = 0; panel < mc; panel += mr) {
+    for (int k = 0; k < kc; ++k) {
+      for (int r = 0; r < mr; ++r) {
+        const int row = panel + r;
+        *packed++ = (row < mc) ? A[(i + row) * N + p + k] : 0.0;
+      }
+    }
+  }
+}
+
+/* Rows [p, p + kc) and columns [j, j + nc) of B in panels of nr columns. */
+static void pack_b(const double *B, const int N, const int p, const int j,
+                   const int kc, const int nc, const int nr, double *packed) {
+  for (int panel = 0; panel < nc; panel += nr) {
+    for (int k = 0; k < kc; ++k) {
+      const double *row = &B[(p + k) * N + j + panel];
+      for (int c = 0; c < nr; ++c) {
+        *packed++ = (panel + c < nc) ? row[c] : 0.0;
+      }
+    }
+  }
+}
+
+static void dgemm_blocked(const double *A, const double *B, double *C,
+                          const int N, const double alpha, const double beta,
+                          const dgemm_blocking_t *b, double *packed_a,
+                          double *packed_b) {
+  const int mr = b->mr;
+  const int nr = b->nr;
+  double tile[8 * 16]; /* the largest MR x NR */
+
+  if (beta != 1.0) {
+    for (int i = 0; i < N * N; ++i) {
+      C[i] *= beta;
+    }
+  }
+
+  for (int jc = 0; jc < N; jc += DGEMM_NC) {
+    const int nc = (N - jc < DGEMM_NC) ? N - jc : DGEMM_NC;
+    for (int pc = 0; pc < N; pc += DGEMM_KC) {
+      const int kc = (N - pc < DGEMM_KC) ? N - pc : DGEMM_KC;
+      pack_b(B, N, pc, jc, kc, nc, nr, packed_b);
+      for (int ic = 0; ic < N; ic += DGEMM_MC) {
+        const int mc = (N - ic < DGEMM_MC) ? N - ic : DGEMM_MC;
+        pack_a(A, N, ic, pc, mc, kc, mr, packed_a);
+        for (int jr = 0; jr < nc; jr += nr) {
+          const double *panel_b = &packed_b[jr * kc];
+          for (int ir = 0; ir < mc; ir += mr) {
+            const double *panel_a = &packed_a[ir * kc];
+            double *c = &C[(ic + ir) * N + jc + jr];
+            if (ir + mr <= mc && jr + nr <= nc) {
+              b->ukr(kc, panel_a, panel_b, c, N, alpha);
+              continue;
+            }
+            /* An edge tile: compute all of it, keep what is inside C. */
+            const int rows = (mc - ir < mr) ? mc - ir : mr;
+            const int cols = (nc - jr < nr) ? nc - jr : nr;
+            memset(tile, 0, sizeof(tile));
+            b->ukr(kc, panel_a, panel_b, tile, nr, alpha);
+            for (int i = 0; i < rows; ++i) {
+              for (int j = 0; j < cols; ++j) {
+                c[i * N + j] += tile[i * nr + j];
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
 typedef struct {
   double *restrict matrixA;
   double *restrict matrixB;
@@ -79,17 +333,74 @@ typedef struct {
   double beta;
   int N;
   int repeats;
+  enum dgemm_kernel kernel;
+  dgemm_blocking_t blocking;
+  double *packed_a; /* MC x KC, for the packed kernels */
+  double *packed_b; /* KC x NC */
 } dgemm_thread_args_t;
 
 static unsigned N;
 static unsigned repeats = 8192;
+#if defined(USE_MKL) || defined(USE_CBLAS) || defined(USE_NVBLAS)
+static enum dgemm_kernel kernel = DGEMM_BLAS;
+#else
+static enum dgemm_kernel kernel = DGEMM_NAIVE;
+#endif
+
+/* Bytes of the packed panels of B: KC x NC, or fewer columns for small N. */
+static size_t packed_b_size(const int n, const int nr) {
+  const int nc = (n < DGEMM_NC) ? (n + nr - 1) / nr * nr : DGEMM_NC;
+  return sizeof(double) * DGEMM_KC * (size_t)nc;
+}
+
+/* Exits if kernel cannot run in this build or on this CPU. */
+static void check_kernel(void) {
+  const char *missing = NULL;
+  switch (kernel) {
+  case DGEMM_NAIVE:
+  case DGEMM_BLOCKED:
+    break;
+  case DGEMM_AVX2:
+#ifdef DGEMM_X86
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("avx2") || !__builtin_cpu_supports("fma")) {
+      missing = "the CPU lacks AVX2 or FMA";
+    }
+#else
+    missing = "it is for x86-64 only";
+#endif
+    break;
+  case DGEMM_AVX512:
+#ifdef DGEMM_X86
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("avx512f")) {
+      missing = "the CPU lacks AVX-512";
+    }
+#else
+    missing = "it is for x86-64 only";
+#endif
+    break;
+  case DGEMM_BLAS:
+#if !defined(USE_MKL) && !defined(USE_CBLAS) && !defined(USE_NVBLAS)
+    missing = "no BLAS library has been compiled in";
+#endif
+    break;
+  }
+  if (missing) {
+    fprintf(stderr, "[dgemm] Kernel %s unavailable: %s\n",
+            dgemm_kernel_names[kernel], missing);
+    exit(EXIT_FAILURE);
+  }
+}
 
 static void dgemm_init(int argc, char *argv[],
                        const benchmark_config_t *const config) {
   N = tune_size(dgemm_ops.name, config, sizeof(double), 3, 2);
 
   static struct option longopts[] = {
-      {"dgemm-rounds", required_argument, NULL, 'r'}, {NULL, 0, NULL, 0}};
+      {"dgemm-rounds", required_argument, NULL, 'r'},
+      {"dgemm-kernel", required_argument, NULL, 'k'},
+      {NULL, 0, NULL, 0}};
 
   while (1) {
     int c = getopt_long(argc, argv, "-", longopts, NULL);
@@ -105,10 +416,27 @@ static void dgemm_init(int argc, char *argv[],
       }
       repeats = (unsigned)tmp;
     } break;
+    case 'k': {
+      unsigned i = 0;
+      while (i < sizeof(dgemm_kernel_names) / sizeof(dgemm_kernel_names[0]) &&
+             strcmp(optarg, dgemm_kernel_names[i]) != 0) {
+        ++i;
+      }
+      if (i == sizeof(dgemm_kernel_names) / sizeof(dgemm_kernel_names[0])) {
+        fprintf(stderr, "Unkown dgemm kernel: %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      kernel = (enum dgemm_kernel)i;
+    } break;
     case ':':
     default:;
     }
   }
+  check_kernel();
+
+  /* As counted by HPCC: the products and the update of C. */
+  const uint64_t n = N;
+  dgemm_ops.flop = repeats * (2 * n * n * n + 2 * n * n);
 }
 
 static void *init_argument(void *arg_) {
@@ -120,9 +448,19 @@ static void *init_argument(void *arg_) {
   arg->repeats = (int)repeats;
   arg->alpha = 1.0;
   arg->beta = 1.0;
-  arg->matrixA = (double *)malloc(sizeof(double) * N * N);
-  arg->matrixB = (double *)malloc(sizeof(double) * N * N);
-  arg->matrixC = (double *)malloc(sizeof(double) * N * N);
+  arg->kernel = kernel;
+  arg->blocking = blocking(kernel);
+  arg->matrixA = (double *)benchmark_alloc(sizeof(double) * N * N);
+  arg->matrixB = (double *)benchmark_alloc(sizeof(double) * N * N);
+  arg->matrixC = (double *)benchmark_alloc(sizeof(double) * N * N);
+  arg->packed_a = NULL;
+  arg->packed_b = NULL;
+  if (kernel != DGEMM_NAIVE && kernel != DGEMM_BLAS) {
+    arg->packed_a =
+        (double *)benchmark_alloc(sizeof(double) * DGEMM_MC * DGEMM_KC);
+    arg->packed_b =
+        (double *)benchmark_alloc(packed_b_size(arg->N, arg->blocking.nr));
+  }
   for (unsigned j = 0; j < N; j++) {
     for (unsigned k = 0; k < N; k++) {
       arg->matrixA[j * N + k] = 2.0;
@@ -137,16 +475,29 @@ static void *init_argument(void *arg_) {
 static void destroy_argument(void *arg_) {
   dgemm_thread_args_t *arg = (dgemm_thread_args_t *)arg_;
 
-  free(arg->matrixA);
-  free(arg->matrixB);
-  free(arg->matrixC);
+  const size_t size = sizeof(double) * (size_t)arg->N * (size_t)arg->N;
+  benchmark_free(arg->matrixA, size);
+  benchmark_free(arg->matrixB, size);
+  benchmark_free(arg->matrixC, size);
+  if (arg->packed_a) {
+    benchmark_free(arg->packed_a, sizeof(double) * DGEMM_MC * DGEMM_KC);
+    benchmark_free(arg->packed_b, packed_b_size(arg->N, arg->blocking.nr));
+  }
   free(arg);
 }
 
 static void *call_work(void *arg_) {
   dgemm_thread_args_t *arg = (dgemm_thread_args_t *)arg_;
-  do_dgemm(arg->matrixA, arg->matrixB, arg->matrixC, arg->N, arg->alpha,
-           arg->beta, arg->repeats);
+  if (arg->packed_a == NULL) {
+    do_dgemm(arg->matrixA, arg->matrixB, arg->matrixC, arg->N, arg->alpha,
+             arg->beta, arg->repeats, arg->kernel == DGEMM_BLAS);
+    return NULL;
+  }
+  for (int r = 0; r < arg->repeats; ++r) {
+    dgemm_blocked(arg->matrixA, arg->matrixB, arg->matrixC, arg->N,
+                  arg->alpha, arg->beta, &arg->blocking, arg->packed_a,
+                  arg->packed_b);
+  }
   return NULL;
 }
 
@@ -77,4 +77,5 @@ static void *hpccg_work(void *arg_) {
 }
 
 benchmark_t hpccg_ops = {"hpccg", hpccg_init, init_argument, NULL,
-                         NULL,    hpccg_work, NULL};
+                         NULL,    hpccg_work, NULL,
+                         0};
@@ -338,4 +338,5 @@ static void *minife(void *arg_) {
 }
 
 benchmark_t minife_ops = {"minife", minife_init, init_argument, NULL,
-                          NULL,     minife,      NULL};
+                          NULL,     minife,      NULL,
+                          0};
@@ -515,6 +515,7 @@ static int sha256_test(void) {
 
 /*** End of LibTomCrypt code ***/
 
+#include "alloc.h"
 #include "sha256.h"
 
 static unsigned long size;
@@ -565,10 +566,7 @@ static void *SHA256_argument_init(void *arg_) {
   }
 
   arg->length = size;
-  arg->buf = (unsigned char *)malloc(arg->length);
-  if (arg->buf == NULL) {
-    exit(EXIT_FAILURE);
-  }
+  arg->buf = (unsigned char *)benchmark_alloc(arg->length);
 
   memset(arg->buf, 0, arg->length);
   sha256_init(&arg->md);
@@ -579,7 +577,7 @@ static void *SHA256_argument_init(void *arg_) {
 static void SHA256_argument_destroy(void *arg_) {
   SHA256_t *arg = (SHA256_t *)arg_;
 
-  free(arg->buf);
+  benchmark_free(arg->buf, arg->length);
   free(arg);
 }
 
@@ -601,5 +599,6 @@ benchmark_t SHA256 = {
     SHA256_argument_destroy,
     SHA256_call,
     NULL,
+    0,
 };
 
@@ -158,6 +158,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "alloc.h"
 #include "stream.h"
 
 #ifndef STREAM_TYPE
@@ -166,6 +167,7 @@
 
 typedef struct {
   STREAM_TYPE *p;
+  size_t bytes; /* of p */
   STREAM_TYPE *a;
   STREAM_TYPE *b;
   STREAM_TYPE *c;
@@ -242,12 +244,9 @@ static void *STREAM_argument_init(void *arg_) {
 
   size_t size_ = (datasets == 2) ? size[COPY] : size[ALL];
 
-  arg->p = (STREAM_TYPE *)malloc(sizeof(STREAM_TYPE) * size_ * datasets +
-                                 sizeof(STREAM_TYPE) * OFFSET);
-
-  if (arg->p == NULL) {
-    exit(EXIT_FAILURE);
-  }
+  arg->bytes = sizeof(STREAM_TYPE) * size_ * datasets +
+               sizeof(STREAM_TYPE) * OFFSET;
+  arg->p = (STREAM_TYPE *)benchmark_alloc(arg->bytes);
 
   arg->a = &arg->p[OFFSET];
   arg->b = &arg->a[size_];
@@ -270,7 +269,7 @@ static void *STREAM_argument_init(void *arg_) {
 static void STREAM_argument_destroy(void *arg_) {
   STREAM_t *arg = (STREAM_t *)arg_;
 
-  free(arg->p);
+  benchmark_free(arg->p, arg->bytes);
   free(arg);
 }
 
@@ -352,11 +351,13 @@ static void *STREAM_call(void *arg_) {
 benchmark_t STREAM_Copy = {
     "STREAM_Copy",           STREAM_Init,      STREAM_argument_init,    NULL,
     STREAM_argument_destroy, STREAM_Copy_call, (void *)&datasets[COPY],
+    0,
 };
 
 benchmark_t STREAM_Scale = {
     "STREAM_Scale",          STREAM_Init,       STREAM_argument_init,     NULL,
     STREAM_argument_destroy, STREAM_Scale_call, (void *)&datasets[SCALE],
+    0,
 };
 
 benchmark_t STREAM_Add = {
@@ -367,11 +368,13 @@ benchmark_t STREAM_Add = {
     STREAM_argument_destroy,
     STREAM_Add_call,
     (void *)&datasets[ADD],
+    0,
 };
 
 benchmark_t STREAM_Triad = {
     "STREAM_Triad",          STREAM_Init,       STREAM_argument_init,     NULL,
     STREAM_argument_destroy, STREAM_Triad_call, (void *)&datasets[TRIAD],
+    0,
 };
 
 benchmark_t STREAM = {
@@ -382,5 +385,6 @@ benchmark_t STREAM = {
     STREAM_argument_destroy,
     STREAM_call,
     (void *)&datasets[ALL],
+    0,
 };
 
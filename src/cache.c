@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <alloc.h>
+#include <arch.h>
+#include <cache.h>
+
+/* Size of the largest data cache above the first CPU of cpuset, or 0. */
+static uint64_t largest_cache(hwloc_topology_t topology,
+                              hwloc_const_cpuset_t cpuset) {
+  uint64_t size = 0;
+  hwloc_obj_t obj =
+      hwloc_get_obj_inside_cpuset_by_type(topology, cpuset, HWLOC_OBJ_PU, 0);
+  for (; obj; obj = obj->parent) {
+    if (benchmark_is_data_cache(obj) && obj->attr->cache.size > size) {
+      size = obj->attr->cache.size;
+    }
+  }
+  return size;
+}
+
+void cache_buffer_init(cache_buffer_t *buffer, const cache_config_t *config,
+                       hwloc_topology_t topology, hwloc_const_cpuset_t cpuset) {
+  buffer->size = config->size;
+  if (buffer->size == 0) {
+    const uint64_t llc = largest_cache(topology, cpuset);
+    /* Without cache information, assume a large last level cache. */
+    buffer->size = (size_t)(llc ? llc : 64UL << 20);
+    if (config->mode == CACHE_COLD) {
+      buffer->size *= 2;
+    }
+  }
+  buffer->data = NULL;
+#ifdef ARCH_HAVE_FLUSH
+  buffer->opt = arch_flush_opt();
+#else
+  buffer->opt = 0;
+#endif
+}
+
+void cache_buffer_free(cache_buffer_t *buffer) {
+  free(buffer->data);
+  buffer->data = NULL;
+  buffer->size = 0;
+}
+
+/* Non-zero the first time, over all workers, for each bit of what. */
+static int first_time(const unsigned what) {
+  static unsigned reported;
+  return (__sync_fetch_and_or(&reported, what) & what) == 0;
+}
+
+#ifdef ARCH_HAVE_FLUSH
+/* The line size and instruction for benchmark_arena_walk(). */
+static __thread const cache_config_t *flush_config;
+static __thread int flush_opt;
+
+static void flush_area(void *data, const size_t size) {
+  const uintptr_t line = flush_config->line_size;
+  const uintptr_t first = (uintptr_t)data / line * line;
+  for (uintptr_t p = first; p < (uintptr_t)data + size; p += line) {
+    arch_flush_line((const void *)p, flush_opt);
+  }
+}
+#endif
+
+/* Allocated when first needed; cold mode may get by without it. */
+static void buffer_alloc(cache_buffer_t *buffer) {
+  if (buffer->data) {
+    return;
+  }
+  buffer->data = (uint8_t *)malloc(buffer->size);
+  if (buffer->data == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+  /* First touch by the worker, so the buffer is on its node. */
+  memset(buffer->data, 0, buffer->size);
+}
+
+/* Read one word per line of the buffer. */
+static void evict(const cache_config_t *config, cache_buffer_t *buffer) {
+  buffer_alloc(buffer);
+  const volatile uint8_t *data = buffer->data;
+  uint8_t sum = 0;
+  for (size_t i = 0; i < buffer->size; i += config->line_size) {
+    sum = (uint8_t)(sum + data[i]);
+  }
+  (void)sum;
+}
+
+/* Modify one word per line, so the benchmark also pays for write-backs. */
+static void pollute(const cache_config_t *config, cache_buffer_t *buffer) {
+  buffer_alloc(buffer);
+  volatile uint8_t *data = buffer->data;
+  for (size_t i = 0; i < buffer->size; i += config->line_size) {
+    data[i] = (uint8_t)(data[i] + 1);
+  }
+}
+
+void cache_prepare(const cache_config_t *config, cache_buffer_t *buffer) {
+  switch (config->mode) {
+  case CACHE_WARM:
+    return;
+  case CACHE_COLD:
+#ifdef ARCH_HAVE_FLUSH
+    flush_config = config;
+    flush_opt = buffer->opt;
+    if (benchmark_arena_walk(flush_area)) {
+      arch_flush_fence();
+      if (first_time(1)) {
+        fprintf(stderr, "[Cache] cold: benchmark data flushed\n");
+      }
+      return;
+    }
+#endif
+    evict(config, buffer);
+    if (first_time(2)) {
+      fprintf(stderr, "[Cache] cold: %zu byte eviction buffer\n",
+              buffer->size);
+    }
+    return;
+  case CACHE_POLLUTED:
+    pollute(config, buffer);
+    if (first_time(4)) {
+      fprintf(stderr, "[Cache] polluted: %zu byte pollution buffer\n",
+              buffer->size);
+    }
+    return;
+  }
+}
@@ -0,0 +1,221 @@
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <resfile.h>
+
+/* Value of an event that was not counted, as in pmu.h. */
+#define NOT_COUNTED UINT64_MAX
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "Usage: %s [--format=text|csv] [--ns] [--info] FILE\n"
+          "Convert a hwperfvar --format=binary result file.\n"
+          "  --format=text  the text format of hwperfvar (default)\n"
+          "  --format=csv   one line per sample\n"
+          "  --ns           durations and start offsets in ns\n"
+          "  --info         print the header of the file\n",
+          name);
+}
+
+static void print_value(FILE *out, uint64_t value, const int counter,
+                        const double ns_per_tick) {
+  if (counter && value == NOT_COUNTED) {
+    fprintf(out, "%10s ", "-");
+    return;
+  }
+  if (counter == 0 && ns_per_tick != 0.0) {
+    value = (uint64_t)llround((double)value * ns_per_tick);
+  }
+  fprintf(out, "%10" PRIu64 " ", value);
+}
+
+/* Same layout as result_print(): one row per thread and counter. */
+static void print_text(FILE *out, const resfile_t *file,
+                       const resfile_block_t *block, const int ns) {
+  const double ns_per_tick = ns ? 1e9 / file->timer_frequency : 0.0;
+  resfile_column_t it;
+  uint64_t value;
+
+  fprintf(out, "# %s\n", block->name);
+  for (unsigned counter = 0; counter < block->counters; ++counter) {
+    if (counter && counter - 1 < file->num_pmcs) {
+      fprintf(out, "# %s\n", file->pmcs[counter - 1]);
+    }
+    for (unsigned thread = 0; thread < block->threads; ++thread) {
+      fprintf(out, "%2d ", block->cpus[thread]);
+      resfile_column(block, thread, counter, &it);
+      while (resfile_column_next(&it, &value)) {
+        print_value(out, value, (int)counter, ns_per_tick);
+      }
+      fprintf(out, "\n");
+    }
+  }
+
+  if (!block->has_starts) {
+    return;
+  }
+
+  /* Start of each repetition relative to the earliest thread. */
+  uint64_t *first = (uint64_t *)malloc(sizeof(uint64_t) * block->repetitions);
+  if (first == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+  for (unsigned rep = 0; rep < block->repetitions; ++rep) {
+    first[rep] = UINT64_MAX;
+  }
+  for (unsigned thread = 0; thread < block->threads; ++thread) {
+    resfile_column(block, thread, RESFILE_STARTS, &it);
+    for (unsigned rep = 0; resfile_column_next(&it, &value); ++rep) {
+      first[rep] = (value < first[rep]) ? value : first[rep];
+    }
+  }
+
+  const double ns_per_timestamp = ns ? 1e9 / file->tsc_frequency : 0.0;
+  fprintf(out, "# start-offset\n");
+  for (unsigned thread = 0; thread < block->threads; ++thread) {
+    fprintf(out, "%2d ", block->cpus[thread]);
+    resfile_column(block, thread, RESFILE_STARTS, &it);
+    for (unsigned rep = 0; resfile_column_next(&it, &value); ++rep) {
+      uint64_t offset = value - first[rep];
+      if (ns_per_timestamp != 0.0) {
+        offset = (uint64_t)llround((double)offset * ns_per_timestamp);
+      }
+      fprintf(out, "%10" PRIu64 " ", offset);
+    }
+    fprintf(out, "\n");
+  }
+  free(first);
+}
+
+/* One line per sample; reads the columns of a thread side by side. */
+static void print_csv(FILE *out, const resfile_t *file,
+                      const resfile_block_t *block, const int ns) {
+  const double ns_per_tick = ns ? 1e9 / file->timer_frequency : 0.0;
+  const unsigned columns = block->counters + (block->has_starts ? 1 : 0);
+  resfile_column_t *its =
+      (resfile_column_t *)malloc(sizeof(resfile_column_t) * columns);
+  if (its == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (unsigned thread = 0; thread < block->threads; ++thread) {
+    for (unsigned c = 0; c < block->counters; ++c) {
+      resfile_column(block, thread, c, &its[c]);
+    }
+    if (block->has_starts) {
+      resfile_column(block, thread, RESFILE_STARTS, &its[block->counters]);
+    }
+
+    /* Threads may have run fewer repetitions than the block (--ci). */
+    uint64_t duration;
+    for (unsigned rep = 0; resfile_column_next(&its[0], &duration); ++rep) {
+      fprintf(out, "%s,%d,%u", block->name, block->cpus[thread], rep);
+      for (unsigned c = 0; c < columns; ++c) {
+        uint64_t value = duration;
+        if (c) {
+          resfile_column_next(&its[c], &value);
+        }
+        if (c == 0 && ns_per_tick != 0.0) {
+          fprintf(out, ",%.0f", (double)value * ns_per_tick);
+        } else if (c && c < block->counters && value == NOT_COUNTED) {
+          fprintf(out, ",");
+        } else {
+          fprintf(out, ",%" PRIu64, value);
+        }
+      }
+      fprintf(out, block->has_starts ? "\n" : ",\n");
+    }
+  }
+  free(its);
+}
+
+int main(int argc, char *argv[]) {
+  enum { TEXT, CSV } format = TEXT;
+  static int ns = 0;
+  static int info = 0;
+  static struct option options[] = {
+      {"format", required_argument, NULL, 'f'},
+      {"ns", no_argument, &ns, 1},
+      {"info", no_argument, &info, 1},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0}};
+
+  while (1) {
+    const int c = getopt_long(argc, argv, "f:h", options, NULL);
+    if (c == -1)
+      break;
+    switch (c) {
+    case 'f':
+      if (strcmp(optarg, "text") == 0) {
+        format = TEXT;
+      } else if (strcmp(optarg, "csv") == 0) {
+        format = CSV;
+      } else {
+        fprintf(stderr, "Unkown format: %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'h':
+      usage(argv[0]);
+      exit(EXIT_SUCCESS);
+    case 0:
+      break;
+    default:
+      usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (optind != argc - 1) {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  resfile_t file;
+  if (resfile_open(&file, argv[optind])) {
+    exit(EXIT_FAILURE);
+  }
+
+  if (info) {
+    fprintf(stdout, "# timer: %s, %.0f Hz\n", file.timer, file.timer_frequency);
+    fprintf(stdout, "# timestamps: %.0f Hz\n", file.tsc_frequency);
+    fprintf(stdout, "# cpuset: %s\n", file.cpuset);
+    for (unsigned i = 0; i < file.num_pmcs; ++i) {
+      fprintf(stdout, "# pmc: %s\n", file.pmcs[i]);
+    }
+    fprintf(stdout, "# topology: %zu bytes of hwloc XML\n",
+            strlen(file.topology));
+  }
+
+  if (format == CSV) {
+    fprintf(stdout, "benchmark,cpu,rep,%s", ns ? "ns" : "ticks");
+    for (unsigned i = 0; i < file.num_pmcs; ++i) {
+      fprintf(stdout, ",%s", file.pmcs[i]);
+    }
+    fprintf(stdout, ",start\n");
+  }
+
+  size_t cursor = 0;
+  resfile_block_t block;
+  int ret;
+  while ((ret = resfile_next_block(&file, &cursor, &block)) > 0) {
+    if (format == CSV) {
+      print_csv(stdout, &file, &block, ns);
+    } else {
+      print_text(stdout, &file, &block, ns);
+    }
+  }
+  resfile_close(&file);
+
+  if (ret < 0) {
+    fprintf(stderr, "%s is truncated or corrupt\n", argv[optind]);
+    exit(EXIT_FAILURE);
+  }
+  return EXIT_SUCCESS;
+}
@@ -7,12 +7,24 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <time.h>
+#include <unistd.h>
 
 #include <hwloc.h>
 
+#include <cache.h>
+#include <metric.h>
 #include <platform.h>
+#include <pmu.h>
+#include <resfile.h>
+#include <sample.h>
+#include <sink.h>
+#include <stats.h>
+#include <timer.h>
+#include <tsc.h>
+#include <tunedb.h>
 #include <worker.h>
 #include <config.h>
+#include "alloc.h"
 #include "benchmark.h"
 
 #include "dgemm.h"
@@ -47,7 +59,14 @@ static uint64_t get_time() {
 static threads_t *spawn_workers(hwloc_topology_t topology,
                                 hwloc_const_cpuset_t cpuset,
                                 int include_hyperthreads,
-                                int do_binding) {
+                                int do_binding,
+                                enum wait_policy wait,
+                                enum barrier_type barrier,
+                                int lockstep,
+                                enum timer_type timer,
+                                const pmu_backend_t *pmu,
+                                const pmu_config_t *pmu_config,
+                                const sample_config_t *sample_config) {
   const hwloc_obj_type_t type =
       (include_hyperthreads) ? HWLOC_OBJ_PU : HWLOC_OBJ_CORE;
   const int depth = hwloc_get_type_or_below_depth(topology, type);
@@ -106,6 +125,14 @@ static threads_t *spawn_workers(hwloc_topology_t topology,
     pthread_mutex_lock(&thread->thread_arg.lock);
     thread->thread_arg.work = NULL;
     thread->thread_arg.s = IDLE;
+    thread->thread_arg.sleepers = 0;
+    thread->thread_arg.wait = wait;
+    thread->thread_arg.timer.type = timer;
+    thread->thread_arg.cache.data = NULL;
+    thread->thread_arg.cache.size = 0;
+    thread->thread_arg.pmu = pmu;
+    thread->thread_arg.pmu_config = pmu_config;
+    thread->thread_arg.sample_config = sample_config;
     thread->thread_arg.run = 1;
     thread->thread_arg.dirigent = i == 0;
     thread->thread_arg.thread = i;
@@ -139,6 +166,20 @@ static threads_t *spawn_workers(hwloc_topology_t topology,
   assert(hwloc_bitmap_weight(allocated) == hwloc_bitmap_weight(cpuset));
 
   workers->cpuset = allocated;
+  workers->barrier = barrier;
+  workers->lockstep = lockstep;
+  workers->deadline = 0;
+  workers->lead = 0;
+  workers->period = 0;
+  workers->offsets = NULL;
+  workers->correct = 0;
+  workers->sampling = 0;
+  workers->sink = NULL;
+  workers->online = 0;
+  workers->warmup = NULL;
+  workers->ci = 0.0;
+  workers->min_reps = 0;
+  workers->cache = NULL;
 
   return workers;
 }
@@ -165,28 +206,276 @@ static struct hwloc_obj_attr_u::hwloc_cache_attr_s l1_attributes(hwloc_topology_
   return cache->attr->cache;
 }
 
+/* Cache levels for --level; DRAM stands for the last level cache. */
+#define LEVEL_DRAM 0
+/* DRAM working sets are this many times the last level cache. */
+#define DRAM_FACTOR 4
+
+/**
+ * Parse a --level argument: L1, L2, ..., or DRAM, optionally followed by
+ * xF to use the fraction F of it, e.g. L2x0.5.
+ **/
+static void parse_level(const char *arg, unsigned *level, double *fraction) {
+  char *end = NULL;
+  if (strncmp(arg, "DRAM", 4) == 0) {
+    *level = LEVEL_DRAM;
+    end = (char *)arg + 4;
+  } else if ((arg[0] == 'L' || arg[0] == 'l') && isdigit(arg[1])) {
+    *level = (unsigned)strtoul(&arg[1], &end, 10);
+    end = (*level == 0) ? NULL : end;
+  }
+  if (end == NULL) {
+    fprintf(stderr, "Unkown cache level: %s\n", arg);
+    exit(EXIT_FAILURE);
+  }
+
+  *fraction = 1.0;
+  if (*end == 'x') {
+    char *suffix = NULL;
+    *fraction = strtod(end + 1, &suffix);
+    end = suffix;
+  }
+  if (*end != '\0' || !(*fraction > 0.0)) {
+    fprintf(stderr, "Could not parse --level argument '%s'\n", arg);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* A cache level as seen by the threads of a cpuset. */
+typedef struct {
+  uint64_t size;       /* per thread */
+  uint64_t cache_size; /* of the cache giving size */
+  unsigned sharers;    /* threads using that cache at the same time */
+  unsigned linesize;
+} cache_level_t;
+
+/**
+ * Find the working set size per thread for a cache level, as seen by the
+ * PUs of cpuset: the smallest such cache, divided by the PUs of cpuset
+ * sharing it if they run at the same time.
+ *
+ * @param level  cache depth, or LEVEL_DRAM for DRAM_FACTOR times the last
+ *               level cache
+ * @param shared threads run concurrently and share caches
+ * @return 0 on success, -1 if a PU of cpuset has no such cache
+ **/
+static int level_size(hwloc_topology_t topology, hwloc_const_cpuset_t cpuset,
+                      const unsigned level, const int shared,
+                      cache_level_t *info) {
+  info->size = UINT64_MAX;
+  int cpu = -1;
+  while ((cpu = hwloc_bitmap_next(cpuset, cpu)) != -1) {
+    hwloc_obj_t pu = hwloc_get_pu_obj_by_os_index(topology, (unsigned)cpu);
+    hwloc_obj_t cache = NULL;
+    for (hwloc_obj_t obj = pu ? pu->parent : NULL; obj; obj = obj->parent) {
+      if (!benchmark_is_data_cache(obj)) {
+        continue;
+      }
+      if (level == LEVEL_DRAM || obj->attr->cache.depth == level) {
+        cache = obj;
+      }
+      if (level != LEVEL_DRAM && cache) {
+        break;
+      }
+    }
+    if (cache == NULL) {
+      return -1;
+    }
+
+    /* The threads of cpuset using this cache. */
+    hwloc_cpuset_t users = hwloc_bitmap_alloc();
+    hwloc_bitmap_and(users, cache->cpuset, cpuset);
+    const unsigned n = shared ? (unsigned)hwloc_bitmap_weight(users) : 1;
+    hwloc_bitmap_free(users);
+
+    const uint64_t bytes = cache->attr->cache.size *
+                           (level == LEVEL_DRAM ? DRAM_FACTOR : 1) / n;
+    if (bytes < info->size) {
+      info->size = bytes;
+      info->cache_size = cache->attr->cache.size;
+      info->sharers = n;
+      info->linesize = cache->attr->cache.linesize;
+    }
+  }
+
+  return (info->size == UINT64_MAX) ? -1 : 0;
+}
+
 typedef struct {
   uint64_t *data;
+  uint64_t *starts; /* start timestamps per thread and repetition, or NULL */
+  sample_hist_t *samples; /* per thread and repetition, or NULL */
   unsigned threads;
   unsigned repetitions;
   unsigned counters;
+  uint64_t release_skew; /* of the barrier before the first repetition */
+  /* Running statistics and their summary per thread and counter, or NULL */
+  online_stats_t *stats;
+  stats_summary_t *summaries;
+  int current_only; /* data and starts only hold the current repetition */
+  unsigned *warmed_up; /* warm-up repetitions discarded per thread */
+  /* Repetitions each thread kept, at most repetitions, and the relative
+   * width of its median's confidence interval with --ci */
+  unsigned *completed;
+  double *ci_width;
 } benchmark_result_t;
 
-static benchmark_result_t result_alloc(const unsigned threads,
+/**
+ * Zeroed memory for a segment of size bytes per thread, each on the NUMA node
+ * of the thread's worker: remote writes of the samples would show up as
+ * variation between the sockets. A page shared by two segments stays with the
+ * first.
+ **/
+static void *alloc_segments(const threads_t *workers, const unsigned threads,
+                            const size_t size) {
+  const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  const size_t total = (threads * size + page - 1) / page * page;
+  void *data = NULL;
+  if (posix_memalign(&data, page, total ? total : page)) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  hwloc_topology_t topology = workers->threads[0].thread_arg.topology;
+  if (hwloc_get_nbobjs_by_type(topology, HWLOC_OBJ_NUMANODE) > 1) {
+    size_t begin = 0;
+    for (unsigned thread = 0; thread < threads; ++thread) {
+      const size_t end = ((thread + 1) * size + page - 1) / page * page;
+      if (end <= begin) {
+        continue;
+      }
+      /* Best effort; moves pages the allocator has touched already. */
+      hwloc_set_area_membind(topology, (char *)data + begin, end - begin,
+                             workers->threads[thread].thread_arg.cpuset,
+                             HWLOC_MEMBIND_BIND, HWLOC_MEMBIND_MIGRATE);
+      begin = end;
+    }
+  }
+  /* The first touch, after the binding. */
+  memset(data, 0, total);
+  return data;
+}
+
+static benchmark_result_t result_alloc(const threads_t *workers,
+                                       const unsigned threads,
                                        const unsigned repetitions,
-                                       const unsigned num_counters) {
+                                       const unsigned num_counters,
+                                       const int record_starts,
+                                       const int record_samples,
+                                       const int streamed,
+                                       const int online) {
+  /* Streamed results are written out while running, online statistics
+   * take them in. */
+  const int current_only = streamed || online;
+  const unsigned kept = current_only ? 1 : repetitions;
   benchmark_result_t result = {.data = NULL,
+                               .starts = NULL,
+                               .samples = NULL,
                                .threads = threads,
                                .repetitions = repetitions,
-                               .counters = num_counters - 1};
-
-  result.data = (uint64_t *)malloc(sizeof(uint64_t) * threads * repetitions *
-                                   num_counters);
+                               .counters = num_counters - 1,
+                               .release_skew = 0,
+                               .stats = NULL,
+                               .summaries = NULL,
+                               .current_only = current_only,
+                               .warmed_up = NULL,
+                               .completed = NULL,
+                               .ci_width = NULL};
+
+  /* Zeroed, so events a PMU backend failed to set up read as 0. */
+  result.data = (uint64_t *)alloc_segments(
+      workers, threads, sizeof(uint64_t) * kept * num_counters);
+  result.warmed_up = (unsigned *)calloc(threads, sizeof(unsigned));
+  result.completed = (unsigned *)calloc(threads, sizeof(unsigned));
+  result.ci_width = (double *)calloc(threads, sizeof(double));
+  if (result.warmed_up == NULL || result.completed == NULL ||
+      result.ci_width == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+  if (record_starts) {
+    result.starts =
+        (uint64_t *)alloc_segments(workers, threads, sizeof(uint64_t) * kept);
+  }
+  if (record_samples) {
+    result.samples = (sample_hist_t *)calloc((size_t)threads * repetitions,
+                                             sizeof(sample_hist_t));
+  }
+  if (online) {
+    const size_t n = (size_t)threads * num_counters;
+    result.stats = (online_stats_t *)malloc(sizeof(online_stats_t) * n);
+    result.summaries = (stats_summary_t *)malloc(sizeof(stats_summary_t) * n);
+    if (result.stats == NULL || result.summaries == NULL) {
+      fprintf(stderr, "Error allocating memory\n");
+      exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < n; ++i) {
+      stats_init(&result.stats[i]);
+    }
+  }
 
   return result;
 }
 
-static void result_free(benchmark_result_t result) { free(result.data); }
+/* Where thread keeps its samples, or only its current one. */
+static uint64_t *result_thread(benchmark_result_t result,
+                               const unsigned thread) {
+  const unsigned kept = result.current_only ? 1 : result.repetitions;
+  return &result.data[thread * kept * (result.counters + 1)];
+}
+
+static uint64_t *result_thread_starts(benchmark_result_t result,
+                                      const unsigned thread) {
+  const unsigned kept = result.current_only ? 1 : result.repetitions;
+  return result.starts ? &result.starts[thread * kept] : NULL;
+}
+
+static void result_free(benchmark_result_t result) {
+  free(result.data);
+  free(result.warmed_up);
+  free(result.completed);
+  free(result.ci_width);
+  free(result.starts);
+  if (result.samples) {
+    for (unsigned i = 0; i < result.threads * result.repetitions; ++i) {
+      sample_hist_free(&result.samples[i]);
+    }
+    free(result.samples);
+  }
+  if (result.stats) {
+    for (unsigned i = 0; i < result.threads * (result.counters + 1); ++i) {
+      stats_free(&result.stats[i]);
+    }
+    free(result.stats);
+    free(result.summaries);
+  }
+}
+
+/* Report the warm-up repetitions each thread discarded. */
+static void warmup_print(benchmark_result_t result, hwloc_const_cpuset_t cpuset,
+                         const warmup_config_t *warmup) {
+  int cpu = -1;
+  for (unsigned thread = 0; thread < result.threads; ++thread) {
+    cpu = hwloc_bitmap_next(cpuset, cpu);
+    fprintf(stderr, "[Warm-up] CPU %2d: discarded %u repetitions%s\n", cpu,
+            result.warmed_up[thread],
+            (warmup->window && result.warmed_up[thread] == warmup->max)
+                ? ", not steady at --warmup-max"
+                : "");
+  }
+}
+
+/* Report how many repetitions each thread needed for the --ci target. */
+static void ci_print(benchmark_result_t result, hwloc_const_cpuset_t cpuset,
+                     const double ci) {
+  int cpu = -1;
+  for (unsigned thread = 0; thread < result.threads; ++thread) {
+    cpu = hwloc_bitmap_next(cpuset, cpu);
+    fprintf(stderr, "[CI] CPU %2d: %u repetitions, median +-%.2f%%%s\n", cpu,
+            result.completed[thread], result.ci_width[thread] * 100.0,
+            (result.ci_width[thread] > ci) ? ", not within --ci" : "");
+  }
+}
 
 #include <benchmark.h>
 
@@ -198,7 +487,7 @@ static benchmark_result_t run_in_parallel(threads_t *workers, benchmark_t *ops,
 static void *null_thread(void *arg_) { return arg_; }
 
 static void synchronize_worker_init(threads_t *threads) {
-  benchmark_t null_ops = {"null", NULL, NULL, NULL, NULL, null_thread, NULL};
+  benchmark_t null_ops = {"null", NULL, NULL, NULL, NULL, null_thread, NULL, 0};
 
   benchmark_result_t result = run_in_parallel(threads, &null_ops, 1, NULL, 1);
   result_free(result);
@@ -211,7 +500,7 @@ static void *stop_thread(void *arg_) {
 }
 
 static int stop_single_worker(thread_data_t *thread, step_t *step) {
-  benchmark_t stop_ops = {"stop", NULL, NULL, NULL, NULL, stop_thread, NULL};
+  benchmark_t stop_ops = {"stop", NULL, NULL, NULL, NULL, stop_thread, NULL, 0};
 
   step->work->ops = &stop_ops;
   step->work->arg = &thread->thread_arg;
@@ -242,7 +531,7 @@ static int stop_single_worker(thread_data_t *thread, step_t *step) {
 }
 
 static void stop_workers(threads_t *workers) {
-  step_t *step = init_step(1);
+  step_t *step = init_step(1, workers->barrier, NULL);
 
   int err = 0;
   for (int i = 0; i < hwloc_bitmap_weight(workers->cpuset); ++i) {
@@ -253,15 +542,25 @@ static void stop_workers(threads_t *workers) {
   }
 
   free_step(step);
+  /* The dirigent's buffer of --cache; the workers free their own. */
+  for (int i = 0; i < hwloc_bitmap_weight(workers->cpuset); ++i) {
+    if (workers->threads[i].thread_arg.dirigent) {
+      cache_buffer_free(&workers->threads[i].thread_arg.cache);
+    }
+  }
 
   if (!err) {
     // TODO cleanup.
   }
 }
 
+/**
+ * @param ns_per_tick if non-zero, print durations in ns instead of timer
+ *                    ticks; start offsets are converted from timestamp ticks.
+ **/
 static void result_print(FILE *file, benchmark_result_t result,
                          hwloc_const_cpuset_t cpuset, const char **pmcs,
-                         const unsigned num_pmcs) {
+                         const unsigned num_pmcs, const double ns_per_tick) {
   assert(num_pmcs == result.counters);
 
   for (unsigned counter = 0; counter < result.counters + 1; ++counter) {
@@ -272,15 +571,213 @@ static void result_print(FILE *file, benchmark_result_t result,
     for (unsigned thread = 0; thread < result.threads; ++thread) {
       cpu = hwloc_bitmap_next(cpuset, cpu);
       fprintf(file, "%2d ", cpu);
-      for (unsigned rep = 0; rep < result.repetitions; ++rep) {
-        fprintf(
-            file, "%10" PRIu64 " ",
+      for (unsigned rep = 0; rep < result.completed[thread]; ++rep) {
+        uint64_t value =
             result.data[thread * result.repetitions * (result.counters + 1) +
-                        (result.counters + 1) * rep + counter]);
+                        (result.counters + 1) * rep + counter];
+        if (counter == 0 && ns_per_tick != 0.0) {
+          value = (uint64_t)llround((double)value * ns_per_tick);
+        }
+        if (counter && value == PMU_NOT_COUNTED) {
+          fprintf(file, "%10s ", "-");
+          continue;
+        }
+        fprintf(file, "%10" PRIu64 " ", value);
+      }
+      fprintf(file, "\n");
+    }
+  }
+
+  if (result.starts == NULL) {
+    return;
+  }
+
+  /* Start of each repetition relative to the earliest thread. */
+  const double ns_per_timestamp =
+      (ns_per_tick != 0.0) ? 1e9 / tsc_frequency() : 0.0;
+  fprintf(file, "# start-offset\n");
+  int cpu = -1;
+  for (unsigned thread = 0; thread < result.threads; ++thread) {
+    cpu = hwloc_bitmap_next(cpuset, cpu);
+    fprintf(file, "%2d ", cpu);
+    for (unsigned rep = 0; rep < result.completed[thread]; ++rep) {
+      uint64_t first = UINT64_MAX;
+      for (unsigned other = 0; other < result.threads; ++other) {
+        if (rep >= result.completed[other]) {
+          continue;
+        }
+        const uint64_t start = result.starts[other * result.repetitions + rep];
+        first = (start < first) ? start : first;
+      }
+      uint64_t offset =
+          result.starts[thread * result.repetitions + rep] - first;
+      if (ns_per_timestamp != 0.0) {
+        offset = (uint64_t)llround((double)offset * ns_per_timestamp);
+      }
+      fprintf(file, "%10" PRIu64 " ", offset);
+    }
+    fprintf(file, "\n");
+  }
+}
+
+/**
+ * Print the derived metrics of each sample, followed by their mean, minimum
+ * and maximum per core. Samples a metric cannot be computed for are printed
+ * as '-' and left out of the summary.
+ *
+ * @param ns_per_tick duration of a timer tick, for metrics using ns
+ **/
+static void metrics_print(FILE *file, benchmark_result_t result,
+                          hwloc_const_cpuset_t cpuset, struct metric **metrics,
+                          const unsigned num_metrics,
+                          const double ns_per_tick) {
+  for (unsigned m = 0; m < num_metrics; ++m) {
+    const struct metric *metric = metrics[m];
+    double *means = (double *)malloc(sizeof(double) * result.threads * 3);
+    if (means == NULL) {
+      fprintf(stderr, "Error allocating memory\n");
+      exit(EXIT_FAILURE);
+    }
+
+    fprintf(file, "# metric %s\n", metric_name(metric));
+    int cpu = -1;
+    for (unsigned thread = 0; thread < result.threads; ++thread) {
+      double sum = 0.0;
+      double min = INFINITY;
+      double max = -INFINITY;
+      unsigned n = 0;
+
+      cpu = hwloc_bitmap_next(cpuset, cpu);
+      fprintf(file, "%2d ", cpu);
+      for (unsigned rep = 0; rep < result.completed[thread]; ++rep) {
+        const uint64_t *sample =
+            &result.data[thread * result.repetitions * (result.counters + 1) +
+                         (result.counters + 1) * rep];
+        const double value = metric_eval(metric, sample, ns_per_tick);
+        if (isnan(value)) {
+          fprintf(file, "%10s ", "-");
+          continue;
+        }
+        fprintf(file, "%10.4g ", value);
+        sum += value;
+        min = (value < min) ? value : min;
+        max = (value > max) ? value : max;
+        ++n;
       }
       fprintf(file, "\n");
+
+      means[thread * 3] = n ? sum / n : NAN;
+      means[thread * 3 + 1] = n ? min : NAN;
+      means[thread * 3 + 2] = n ? max : NAN;
+    }
+
+    fprintf(file, "# metric %s per core: mean min max\n", metric_name(metric));
+    cpu = -1;
+    for (unsigned thread = 0; thread < result.threads; ++thread) {
+      cpu = hwloc_bitmap_next(cpuset, cpu);
+      fprintf(file, "%2d ", cpu);
+      for (unsigned i = 0; i < 3; ++i) {
+        if (isnan(means[thread * 3 + i])) {
+          fprintf(file, "%10s ", "-");
+        } else {
+          fprintf(file, "%10.4g ", means[thread * 3 + i]);
+        }
+      }
+      fprintf(file, "\n");
+    }
+    free(means);
+  }
+}
+
+static void summary_print(FILE *file, const stats_summary_t *summary,
+                          const double scale) {
+  const uint64_t values[] = {summary->min, summary->p50, summary->p99,
+                             summary->p999, summary->max};
+  fprintf(file, "%10" PRIu64 " %12.1f %12.1f %8.4f ", summary->count,
+          summary->mean * scale, summary->stddev * scale, summary->cv);
+  for (unsigned i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+    fprintf(file, "%10" PRIu64 " ", (uint64_t)llround((double)values[i] * scale));
+  }
+  fprintf(file, "\n");
+}
+
+/**
+ * Print the running statistics of --online per core, and over all cores,
+ * for the duration and each counter. Quantiles are accurate to 1%.
+ *
+ * @param ns_per_tick if non-zero, print durations in ns instead of timer
+ *                    ticks
+ **/
+static void stats_print(FILE *file, benchmark_result_t result,
+                        hwloc_const_cpuset_t cpuset, const char **pmcs,
+                        const double ns_per_tick) {
+  if (result.stats == NULL) {
+    return;
+  }
+
+  const unsigned counters = result.counters + 1;
+  for (unsigned counter = 0; counter < counters; ++counter) {
+    const double scale =
+        (counter == 0 && ns_per_tick != 0.0) ? ns_per_tick : 1.0;
+    fprintf(file,
+            "# stats %s: cpu count mean stddev cv min p50 p99 p99.9 max\n",
+            counter ? pmcs[counter - 1] : (ns_per_tick != 0.0 ? "ns" : "ticks"));
+
+    online_stats_t all;
+    stats_init(&all);
+    int cpu = -1;
+    for (unsigned thread = 0; thread < result.threads; ++thread) {
+      cpu = hwloc_bitmap_next(cpuset, cpu);
+      fprintf(file, "%3d ", cpu);
+      summary_print(file, &result.summaries[thread * counters + counter],
+                    scale);
+      stats_merge(&all, &result.stats[thread * counters + counter]);
+    }
+
+    stats_summary_t summary;
+    stats_summarize(&all, &summary);
+    fprintf(file, "%3s ", "all");
+    summary_print(file, &summary, scale);
+    stats_free(&all);
+  }
+}
+
+/**
+ * Print the most sampled addresses of each repetition, then of all
+ * repetitions of each core, to compare outliers with typical repetitions.
+ *
+ * @param top number of addresses per line
+ **/
+static void samples_print(FILE *file, benchmark_result_t result,
+                          hwloc_const_cpuset_t cpuset, const unsigned top) {
+  if (result.samples == NULL) {
+    return;
+  }
+
+  fprintf(file, "# samples: cpu rep samples lost [address symbol count]...\n");
+  int cpu = -1;
+  for (unsigned thread = 0; thread < result.threads; ++thread) {
+    cpu = hwloc_bitmap_next(cpuset, cpu);
+    for (unsigned rep = 0; rep < result.completed[thread]; ++rep) {
+      fprintf(file, "%2d %4u ", cpu, rep);
+      sample_hist_print(file, &result.samples[thread * result.repetitions + rep],
+                        top);
     }
   }
+
+  fprintf(file, "# samples per core: cpu samples lost [address symbol count]...\n");
+  cpu = -1;
+  for (unsigned thread = 0; thread < result.threads; ++thread) {
+    cpu = hwloc_bitmap_next(cpuset, cpu);
+    sample_hist_t total = {NULL, 0, 0, 0};
+    for (unsigned rep = 0; rep < result.completed[thread]; ++rep) {
+      sample_hist_merge(&total,
+                        &result.samples[thread * result.repetitions + rep]);
+    }
+    fprintf(file, "%2d ", cpu);
+    sample_hist_print(file, &total, top);
+    sample_hist_free(&total);
+  }
 }
 
 static benchmark_result_t run_in_parallel(threads_t *workers, benchmark_t *ops,
@@ -288,19 +785,31 @@ static benchmark_result_t run_in_parallel(threads_t *workers, benchmark_t *ops,
                                           const char **pmcs,
                                           const unsigned num_pmcs) {
   const int cpus = hwloc_bitmap_weight(workers->cpuset);
-  benchmark_result_t result =
-      result_alloc((unsigned)cpus, repetitions, num_pmcs);
-  step_t *step = init_step(cpus);
+  benchmark_result_t result = result_alloc(
+      workers, (unsigned)cpus, repetitions, num_pmcs,
+      workers->lockstep || workers->deadline || workers->correct,
+      workers->sampling, workers->sink != NULL, workers->online);
+  step_t *step = init_step(cpus, workers->barrier, workers->threads);
+  step_synchronize(step, workers, repetitions);
 
   for (int i = 0; i < cpus; ++i) {
     work_t *work = &step->work[i];
     work->ops = ops;
     work->arg = ops->state;
     work->barrier = &step->barrier;
-    work->result = &result.data[(unsigned)i * repetitions * num_pmcs];
+    work->result = result_thread(result, (unsigned)i);
     work->reps = repetitions;
     work->pmcs = pmcs;
     work->num_pmcs = num_pmcs - 1;
+    work->starts = result_thread_starts(result, (unsigned)i);
+    work->sink = workers->sink ? &workers->sink->rings[i] : NULL;
+    if (result.stats) {
+      work->stats = &result.stats[(unsigned)i * num_pmcs];
+      work->summaries = &result.summaries[(unsigned)i * num_pmcs];
+    }
+    if (result.samples) {
+      work->samples = &result.samples[(unsigned)i * repetitions];
+    }
 
     struct arg *arg = &workers->threads[i].thread_arg;
     queue_work(arg, work);
@@ -312,7 +821,13 @@ static benchmark_result_t run_in_parallel(threads_t *workers, benchmark_t *ops,
   for (int i = 0; i < cpus; ++i) {
     wait_until_done(&workers->threads[i].thread_arg);
   }
+  for (int i = 0; i < cpus; ++i) {
+    result.warmed_up[i] = step->work[i].warmed_up;
+    result.completed[i] = step->work[i].completed;
+    result.ci_width[i] = step->work[i].ci_width;
+  }
 
+  result.release_skew = step_release_skew(step);
   free_step(step);
 
   return result;
@@ -324,8 +839,9 @@ static benchmark_result_t run_one_by_one(threads_t *workers, benchmark_t *ops,
                                          const unsigned num_pmcs) {
   const int cpus = hwloc_bitmap_weight(workers->cpuset);
   benchmark_result_t result =
-      result_alloc((unsigned)cpus, repetitions, num_pmcs);
-  step_t *step = init_step(1);
+      result_alloc(workers, (unsigned)cpus, repetitions, num_pmcs, 0,
+                   workers->sampling, workers->sink != NULL, workers->online);
+  step_t *step = init_step(1, workers->barrier, NULL);
 
   uint64_t diff = 0;
   for (int i = 0; i < cpus; ++i) {
@@ -333,10 +849,22 @@ static benchmark_result_t run_one_by_one(threads_t *workers, benchmark_t *ops,
     work->ops = ops;
     work->arg = ops->state;
     work->barrier = &step->barrier;
-    work->result = &result.data[(unsigned)i * repetitions * num_pmcs];
+    work->result = result_thread(result, (unsigned)i);
     work->reps = repetitions;
     work->pmcs = pmcs;
     work->num_pmcs = num_pmcs - 1;
+    if (result.samples) {
+      work->samples = &result.samples[(unsigned)i * repetitions];
+    }
+    work->sink = workers->sink ? &workers->sink->rings[i] : NULL;
+    if (result.stats) {
+      work->stats = &result.stats[(unsigned)i * num_pmcs];
+      work->summaries = &result.summaries[(unsigned)i * num_pmcs];
+    }
+    work->warmup = workers->warmup;
+    work->ci = workers->ci;
+    work->min_reps = workers->min_reps;
+    work->cache = workers->cache;
 
     if (i) {
       const unsigned secs = (unsigned)(diff / (1000 * 1000 * 1000UL));
@@ -362,6 +890,9 @@ static benchmark_result_t run_one_by_one(threads_t *workers, benchmark_t *ops,
     }
     wait_until_done(arg);
     diff = get_time() - begin;
+    result.warmed_up[i] = work->warmed_up;
+    result.completed[i] = work->completed;
+    result.ci_width[i] = work->ci_width;
   }
 
   free_step(step);
@@ -381,9 +912,12 @@ run_two_benchmarks(threads_t *workers, benchmark_t *ops1, benchmark_t *ops2,
   assert(hwloc_bitmap_isincluded(cpuset, workers->cpuset));
   const int cpus = hwloc_bitmap_weight(cpuset);
   assert(cpus > 0);
-  benchmark_result_t result =
-      result_alloc((unsigned)cpus, repetitions, num_pmcs);
-  step_t *step = init_step(cpus);
+  benchmark_result_t result = result_alloc(
+      workers, (unsigned)cpus, repetitions, num_pmcs,
+      workers->lockstep || workers->deadline || workers->correct,
+      workers->sampling, workers->sink != NULL, workers->online);
+  step_t *step = init_step(cpus, workers->barrier, workers->threads);
+  step_synchronize(step, workers, repetitions);
 
   for (int i = 0; i < cpus; ++i) {
     struct arg *arg = &workers->threads[i].thread_arg;
@@ -391,10 +925,19 @@ run_two_benchmarks(threads_t *workers, benchmark_t *ops1, benchmark_t *ops2,
     work->ops = hwloc_bitmap_isset(set1, arg->cpu) ? ops1 : ops2;
     work->arg = hwloc_bitmap_isset(set1, arg->cpu) ? ops1->state : ops2->state;
     work->barrier = &step->barrier;
-    work->result = &result.data[(unsigned)i * repetitions * num_pmcs];
+    work->result = result_thread(result, (unsigned)i);
     work->reps = repetitions;
     work->pmcs = pmcs;
     work->num_pmcs = num_pmcs - 1;
+    work->starts = result_thread_starts(result, (unsigned)i);
+    work->sink = workers->sink ? &workers->sink->rings[i] : NULL;
+    if (result.stats) {
+      work->stats = &result.stats[(unsigned)i * num_pmcs];
+      work->summaries = &result.summaries[(unsigned)i * num_pmcs];
+    }
+    if (result.samples) {
+      work->samples = &result.samples[(unsigned)i * repetitions];
+    }
 
     queue_work(arg, work);
   }
@@ -405,75 +948,301 @@ run_two_benchmarks(threads_t *workers, benchmark_t *ops1, benchmark_t *ops2,
   for (int i = 1; i < cpus; ++i) {
     wait_until_done(&workers->threads[i].thread_arg);
   }
+  for (int i = 0; i < cpus; ++i) {
+    result.warmed_up[i] = step->work[i].warmed_up;
+    result.completed[i] = step->work[i].completed;
+    result.ci_width[i] = step->work[i].ci_width;
+  }
 
+  result.release_skew = step_release_skew(step);
   hwloc_bitmap_free(cpuset);
   free_step(step);
 
   return result;
 }
 
+/* The core whose repetition time chooses the rounds of --auto. */
+enum tune_core { TUNE_MEDIAN, TUNE_SLOWEST };
+
+static const char *tune_core_name(const enum tune_core core) {
+  return (core == TUNE_SLOWEST) ? "slowest" : "median";
+}
+
+typedef struct {
+  double time; /* target seconds per repetition */
+  enum tune_core core;
+  double frequency; /* of the workers' timer */
+  const char *db;   /* the tuning database, or NULL */
+  int retune;       /* tune again even if the database has the rounds */
+  tune_key_t key;   /* host, CPU and build; the rest is filled in per tuning */
+} tune_config_t;
+
+static int compare_u64(const void *a, const void *b) {
+  const uint64_t x = *(const uint64_t *)a;
+  const uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
 /**
- * Tune the rounds parameter such that a pre-defined benchmark runtime is
- * achieved.
+ * Run a few repetitions of benchmark concurrently on all workers.
  *
- * Assumes, that the benchmark is configured for the desired size.
+ * @return seconds per repetition of the median or slowest worker, each by
+ *         its median repetition
+ **/
+static double tune_probe(threads_t *probe, benchmark_t *benchmark,
+                         const tune_config_t *tune) {
+  const unsigned reps = 3;
+  benchmark_result_t result = run_in_parallel(probe, benchmark, reps, NULL, 1);
+
+  uint64_t *medians = (uint64_t *)malloc(sizeof(uint64_t) * result.threads);
+  if (medians == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+  for (unsigned thread = 0; thread < result.threads; ++thread) {
+    uint64_t *durations = result_thread(result, thread);
+    qsort(durations, result.completed[thread], sizeof(uint64_t), compare_u64);
+    medians[thread] = durations[result.completed[thread] / 2];
+  }
+  qsort(medians, result.threads, sizeof(uint64_t), compare_u64);
+  const unsigned thread = (tune->core == TUNE_SLOWEST)
+                              ? result.threads - 1
+                              : (result.threads - 1) / 2;
+  const double seconds = (double)medians[thread] / tune->frequency;
+
+  free(medians);
+  result_free(result);
+  return seconds;
+}
+
+/**
+ * Rounds for the target time from two probes, fitting t = c * rounds^k
+ * through them: the time per round need not be constant, e.g. with set-up
+ * costs per repetition or caches warming up over the rounds.
  *
- * @param benchmark the benchmark to tune
- * @param target_seconds the target runtime in seconds
- * @param init_rounds the rounds-parameter the benchmark was initialized with
+ * @param predicted set to the time the fit predicts for the rounds
  **/
-static unsigned tune_time(benchmark_t *benchmark, const double target_seconds,
-                          const unsigned init_rounds) {
-  void *benchmark_arg =
-      (benchmark->init_arg) ? benchmark->init_arg(benchmark->state) : NULL;
-  const uint64_t start = get_time();
-  unsigned rep;
-  for (rep = 0; get_time() < start + 1000 * 1000 * 1000UL; ++rep) {
-    if (benchmark->reset_arg) {
-      benchmark->reset_arg(benchmark_arg);
-    }
-    benchmark->call(benchmark_arg);
+static unsigned tune_fit(const unsigned r1, const double t1, const unsigned r2,
+                         const double t2, const double target,
+                         double *predicted) {
+  double k = log(t2 / t1) / log((double)r2 / r1);
+  /* Probes too close or too noisy for a fit; scale linearly. */
+  if (!isfinite(k) || k < 0.5 || k > 2.0) {
+    k = 1.0;
   }
-  const uint64_t end = get_time();
-  const uint64_t duration = end - start;
+  double rounds = (t2 > 0.0) ? r2 * pow(target / t2, 1.0 / k) : UINT_MAX;
+  rounds = nearbyint(rounds);
+  rounds = (rounds < 1.0) ? 1.0 : (rounds > UINT_MAX) ? UINT_MAX : rounds;
+  *predicted = t2 * pow(rounds / r2, k);
+  return (unsigned)rounds;
+}
 
-  const double rounds = (target_seconds * 1e9 * rep * init_rounds) / duration;
-  const double rounds_i = nearbyint(rounds);
-  assert(rounds <= UINT_MAX);
-  unsigned ret = (unsigned)rounds_i;
-  if (ret < 1) {
-    ret = 1;
+/* Initialize the benchmarks with argv and a --*-rounds= argument each. */
+static void init_rounds(benchmark_t **benchmarks,
+                        const unsigned num_benchmarks, const int argc,
+                        char *argv[], const unsigned *rounds,
+                        const benchmark_config_t *const config) {
+  const unsigned num_args = (unsigned)argc + num_benchmarks;
+  char **myargv = (char **)malloc(sizeof(char *) * num_args);
+  /* getopt() permutes myargv, so keep the arguments to free them. */
+  char **args = (char **)malloc(sizeof(char *) * num_benchmarks);
+  if (myargv == NULL || args == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(myargv, argv, (unsigned)argc * sizeof(char *));
+  for (unsigned i = 0; i < num_benchmarks; ++i) {
+    if (asprintf(&args[i], "--%s-rounds=%u", benchmarks[i]->name,
+                 rounds[i]) < 0) {
+      fprintf(stderr, "Error allocating memory\n");
+      exit(EXIT_FAILURE);
+    }
+    myargv[argc + i] = args[i];
   }
-  const double runtime = ret / rep * duration / 1e9 / init_rounds;
 
-  fprintf(stderr, "[Time] --%s-rounds=%u (~%4.1fs)\n", benchmark->name, ret,
-          runtime);
+  init_benchmarks((int)num_args, myargv, config);
 
-  return ret;
+  for (unsigned i = 0; i < num_benchmarks; ++i) {
+    free(args[i]);
+  }
+  free(args);
+  free(myargv);
 }
 
-static void tune_benchmarks_time(benchmark_t **benchmarks,
-                                 const unsigned num_benchmarks, char *argv[],
-                                 const unsigned argc, const double time,
-                                 const benchmark_config_t *const config) {
-  const unsigned rounds = 10;
+/**
+ * The arguments in argv for benchmark besides its rounds, e.g.
+ * --dgemm-kernel=naive, separated by spaces, as part of its tuning key.
+ **/
+static char *tune_args(const benchmark_t *benchmark, const int argc,
+                       char *argv[]) {
+  char *prefix;
+  if (asprintf(&prefix, "--%s-", benchmark->name) < 0) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+  const size_t length = strlen(prefix);
+  size_t size = 1;
+  for (int i = 1; i < argc; ++i) {
+    size += strlen(argv[i]) + 1;
+  }
+  char *args = (char *)calloc(size, 1);
+  if (args == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+  for (int i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], prefix, length) != 0 ||
+        strncmp(&argv[i][length], "rounds", 6) == 0) {
+      continue;
+    }
+    if (*args) {
+      strcat(args, " ");
+    }
+    strcat(args, argv[i]);
+  }
+  free(prefix);
+  /* The database separates fields with tabs and tunings with newlines. */
+  for (char *c = args; *c; ++c) {
+    if (*c == '\t' || *c == '\n') {
+      *c = ' ';
+    }
+  }
+  return args;
+}
+
+/**
+ * Tune the rounds parameter of the benchmarks such that a repetition takes
+ * the target time, with all benchmarks configured for config.
+ *
+ * The benchmarks run concurrently on all workers, as in a parallel run. A
+ * first probe grows the rounds until a repetition takes a millisecond, a
+ * second one aims at up to 0.2s; the rounds are fitted through both. Tunings
+ * are looked up in and added to the tuning database.
+ *
+ * @param argv   the arguments for the benchmarks, besides the rounds
+ * @param rounds set to the tuned rounds of each benchmark
+ **/
+static void tune_benchmarks_time(threads_t *workers, benchmark_t **benchmarks,
+                                 const unsigned num_benchmarks, const int argc,
+                                 char *argv[], const tune_config_t *tune,
+                                 const benchmark_config_t *const config,
+                                 unsigned *rounds) {
+  /* Nothing recorded but the durations, and no --cache between them. */
+  threads_t probe = *workers;
+  probe.lockstep = 0;
+  probe.deadline = 0;
+  probe.correct = 0;
+  probe.sampling = 0;
+  probe.sink = NULL;
+  probe.online = 0;
+  probe.warmup = NULL;
+  probe.ci = 0.0;
+  probe.cache = NULL;
+
+  const double min_probe = 1e-3;
+  const double max_probe = (tune->time < 0.2) ? tune->time : 0.2;
+
+  unsigned *first = (unsigned *)calloc(num_benchmarks, sizeof(unsigned));
+  double *first_time = (double *)malloc(sizeof(double) * num_benchmarks);
+  double *predicted = (double *)malloc(sizeof(double) * num_benchmarks);
+  int *cached = (int *)malloc(sizeof(int) * num_benchmarks);
+  char **args = (char **)malloc(sizeof(char *) * num_benchmarks);
+  if (first == NULL || first_time == NULL ||
+      predicted == NULL || cached == NULL || args == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  tune_key_t key = tune->key;
+  key.size = config->size;
+  key.fill = config->fill_factor;
+  key.time = tune->time;
+  key.core = tune_core_name(tune->core);
+
+  int pending = 0;
   for (unsigned i = 0; i < num_benchmarks; ++i) {
-    asprintf(&argv[argc + i], "--%s-rounds=%u", benchmarks[i]->name, rounds);
+    args[i] = tune_args(benchmarks[i], argc, argv);
+    key.benchmark = benchmarks[i]->name;
+    key.args = args[i];
+    cached[i] = tune->db && !tune->retune &&
+                tunedb_lookup(tune->db, &key, &rounds[i]) == 0;
+    if (!cached[i]) {
+      rounds[i] = 10;
+      pending = 1;
+    }
   }
 
-  init_benchmarks((int)(argc + num_benchmarks), argv, config);
+  while (pending) {
+    pending = 0;
+    init_rounds(benchmarks, num_benchmarks, argc, argv, rounds, config);
+    for (unsigned i = 0; i < num_benchmarks; ++i) {
+      if (cached[i] || first[i]) {
+        continue;
+      }
+      const double seconds = tune_probe(&probe, benchmarks[i], tune);
+      if (seconds < min_probe && rounds[i] <= UINT_MAX / 10) {
+        rounds[i] *= 10;
+        pending = 1;
+        continue;
+      }
+      first[i] = rounds[i];
+      first_time[i] = seconds;
+      /* Halve slow ones, so the second probe does not take even longer. */
+      double second = (seconds > 0.0) ? rounds[i] * max_probe / seconds
+                                      : 2.0 * rounds[i];
+      if (seconds >= max_probe && rounds[i] >= 2) {
+        second = rounds[i] / 2;
+      } else if (second < 2.0 * rounds[i]) {
+        second = 2.0 * rounds[i];
+      }
+      rounds[i] = (second > UINT_MAX) ? UINT_MAX : (unsigned)second;
+    }
+  }
 
+  init_rounds(benchmarks, num_benchmarks, argc, argv, rounds, config);
   for (unsigned i = 0; i < num_benchmarks; ++i) {
-    free(argv[argc + i]);
-    asprintf(&argv[argc + i], "--%s-rounds=%u", benchmarks[i]->name,
-             tune_time(benchmarks[i], time, rounds));
+    if (cached[i]) {
+      continue;
+    }
+    const double seconds = tune_probe(&probe, benchmarks[i], tune);
+    rounds[i] = tune_fit(first[i], first_time[i], rounds[i], seconds,
+                         tune->time, &predicted[i]);
+    if (tune->db) {
+      key.benchmark = benchmarks[i]->name;
+      key.args = args[i];
+      tunedb_store(tune->db, &key, rounds[i]);
+      /* Reading it back catches keys the database cannot hold. */
+      unsigned stored = 0;
+      if (tunedb_lookup(tune->db, &key, &stored) || stored != rounds[i]) {
+        fprintf(stderr, "[Tune] %s does not return the tuning of %s\n",
+                tune->db, benchmarks[i]->name);
+      }
+    }
   }
 
+  for (unsigned i = 0; i < num_benchmarks; ++i) {
+    if (cached[i]) {
+      fprintf(stderr, "[Time] --%s-rounds=%u (cached)\n", benchmarks[i]->name,
+              rounds[i]);
+    } else {
+      fprintf(stderr, "[Time] --%s-rounds=%u (~%4.1fs)\n",
+              benchmarks[i]->name, rounds[i], predicted[i]);
+    }
+  }
   fprintf(stderr, "[Time] ");
   for (unsigned i = 0; i < num_benchmarks; ++i) {
-    fprintf(stderr, "%s ", argv[argc + i]);
+    fprintf(stderr, "--%s-rounds=%u ", benchmarks[i]->name, rounds[i]);
   }
   fprintf(stderr, "\n");
+
+  for (unsigned i = 0; i < num_benchmarks; ++i) {
+    free(args[i]);
+  }
+  free(args);
+  free(cached);
+  free(predicted);
+  free(first_time);
+  free(first);
 }
 
 static int file_exists(const char *name) {
@@ -510,6 +1279,223 @@ static unsigned si_suffix_to_factor(int suffix) {
   }
 }
 
+/* Working set sizes of --sweep, from first to last. */
+typedef struct {
+  uint64_t first;
+  uint64_t last;
+  unsigned points; /* 0 if not sweeping */
+  int geometric;   /* else linear steps */
+} sweep_t;
+
+static uint64_t parse_size(const char *arg, const char *name, char **end) {
+  errno = 0;
+  const unsigned long long value = strtoull(arg, end, 0);
+  if (errno == ERANGE || *end == arg) {
+    fprintf(stderr, "Could not parse --%s argument '%s'\n", name, arg);
+    exit(EXIT_FAILURE);
+  }
+  if (**end != ':' && **end != '\0') {
+    return value * si_suffix_to_factor(*(*end)++);
+  }
+  return value;
+}
+
+/**
+ * Parse a --sweep argument FIRST:LAST:geom|lin:POINTS, with sizes in bytes
+ * and the suffixes of --size, e.g. 4K:1G:geom:24.
+ **/
+static void parse_sweep(const char *arg, sweep_t *sweep) {
+  char *end = NULL;
+  sweep->first = parse_size(arg, "sweep", &end);
+  if (*end++ != ':') {
+    end = NULL;
+  }
+  if (end) {
+    sweep->last = parse_size(end, "sweep", &end);
+    end = (*end == ':') ? end + 1 : NULL;
+  }
+  if (end && strncmp(end, "geom:", 5) == 0) {
+    sweep->geometric = 1;
+    end += 5;
+  } else if (end && strncmp(end, "lin:", 4) == 0) {
+    sweep->geometric = 0;
+    end += 4;
+  } else {
+    end = NULL;
+  }
+  if (end) {
+    errno = 0;
+    char *tail = NULL;
+    const unsigned long points = strtoul(end, &tail, 10);
+    end = (errno || *tail != '\0' || points > UINT_MAX) ? NULL : end;
+    sweep->points = (unsigned)points;
+  }
+
+  if (end == NULL || sweep->points < 2 || sweep->first == 0 ||
+      sweep->first >= sweep->last) {
+    fprintf(stderr, "Could not parse --sweep argument '%s', expected "
+                    "FIRST:LAST:geom|lin:POINTS with FIRST < LAST and at "
+                    "least 2 points\n",
+            arg);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static uint64_t sweep_size(const sweep_t *sweep, const unsigned point) {
+  const double t = (double)point / (sweep->points - 1);
+  if (sweep->geometric) {
+    return (uint64_t)llround((double)sweep->first *
+                             pow((double)sweep->last / sweep->first, t));
+  }
+  return sweep->first +
+         (uint64_t)llround((double)(sweep->last - sweep->first) * t);
+}
+
+/**
+ * Initialize the benchmarks for config. With --auto, tune their rounds on
+ * the workers first.
+ **/
+static void setup_benchmarks(threads_t *workers, benchmark_t **benchmarks,
+                             const unsigned num_benchmarks, const int argc,
+                             char *argv[], const int auto_tune,
+                             const tune_config_t *tune,
+                             benchmark_config_t *config) {
+  if (auto_tune) {
+    unsigned *rounds = (unsigned *)malloc(sizeof(unsigned) * num_benchmarks);
+    if (rounds == NULL) {
+      fprintf(stderr, "Error allocating memory\n");
+      exit(EXIT_FAILURE);
+    }
+    tune_benchmarks_time(workers, benchmarks, num_benchmarks, argc, argv, tune,
+                         config, rounds);
+    config->verbose = 0;
+    init_rounds(benchmarks, num_benchmarks, argc, argv, rounds, config);
+    config->verbose = 1;
+    free(rounds);
+  } else {
+    init_benchmarks(argc, argv, config);
+  }
+}
+
+/* Statistics of the durations of all threads, e.g. for a --sweep curve. */
+static void result_summarize(benchmark_result_t result,
+                             stats_summary_t *summary) {
+  const unsigned counters = result.counters + 1;
+  online_stats_t all;
+  stats_init(&all);
+  if (result.stats) {
+    for (unsigned thread = 0; thread < result.threads; ++thread) {
+      stats_merge(&all, &result.stats[thread * counters]);
+    }
+  } else if (!result.current_only) {
+    for (unsigned thread = 0; thread < result.threads; ++thread) {
+      for (unsigned rep = 0; rep < result.completed[thread]; ++rep) {
+        stats_add(&all, result.data[(thread * result.repetitions + rep) *
+                                    counters]);
+      }
+    }
+  }
+  stats_summarize(&all, summary);
+  stats_free(&all);
+}
+
+/**
+ * Print the duration over the working set sizes of a --sweep, with the
+ * sizes per thread at which the cache levels end.
+ *
+ * @param curve       a summary per size; empty ones are left out
+ * @param boundaries  size per thread of each cache level, from L1 on
+ * @param ns_per_tick if non-zero, print durations in ns instead of timer
+ *                    ticks
+ **/
+static void sweep_print(FILE *file, const char *name, const sweep_t *sweep,
+                        const stats_summary_t *curve,
+                        const uint64_t *boundaries, const unsigned levels,
+                        const double ns_per_tick) {
+  fprintf(file,
+          "# sweep %s: bytes level count mean stddev cv min p50 p99 p99.9 "
+          "max\n",
+          name);
+  unsigned level = 0;
+  for (unsigned point = 0; point < sweep->points; ++point) {
+    const uint64_t size = sweep_size(sweep, point);
+    while (level < levels && size > boundaries[level]) {
+      fprintf(file, "# L%u boundary: %" PRIu64 " bytes per thread\n",
+              level + 1, boundaries[level]);
+      ++level;
+    }
+    if (curve[point].count == 0) {
+      continue;
+    }
+
+    char level_name[8] = "DRAM";
+    if (level < levels) {
+      snprintf(level_name, sizeof(level_name), "L%u", level + 1);
+    }
+    fprintf(file, "%12" PRIu64 " %4s ", size, level_name);
+    summary_print(file, &curve[point],
+                  (ns_per_tick != 0.0) ? ns_per_tick : 1.0);
+  }
+}
+
+/**
+ * Compile the comma-separated list of metrics in opt. Entries are the names
+ * of built-in metrics, NAME=EXPR for ad-hoc ones, or "all" for every
+ * built-in metric whose events are counted.
+ **/
+static struct metric **parse_metrics(char *opt, const char **pmcs,
+                                     const unsigned num_pmcs,
+                                     unsigned *num_metrics) {
+  unsigned capacity = count_chars(opt, ',') + 1;
+  while (metric_builtin_idx(capacity) != NULL) {
+    ++capacity;
+  }
+  struct metric **metrics =
+      (struct metric **)malloc(sizeof(struct metric *) * capacity);
+  if (metrics == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  unsigned n = 0;
+  for (char *arg = strtok(opt, ","); arg != NULL; arg = strtok(NULL, ",")) {
+    if (strcmp(arg, "all") == 0) {
+      const char *name;
+      for (unsigned i = 0; (name = metric_builtin_idx(i)) != NULL; ++i) {
+        if (metric_builtin_available(name, pmcs, num_pmcs)) {
+          metrics[n++] = metric_compile(name, metric_builtin(name), pmcs,
+                                        num_pmcs);
+        }
+      }
+      continue;
+    }
+
+    const char *name = arg;
+    const char *expr;
+    char *equals = strchr(arg, '=');
+    if (equals != NULL) {
+      *equals = '\0';
+      expr = equals + 1;
+    } else {
+      expr = metric_builtin(name);
+      if (expr == NULL) {
+        fprintf(stderr, "Unkown metric: %s. Available metrics:\n", name);
+        list_metrics();
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    struct metric *metric = metric_compile(name, expr, pmcs, num_pmcs);
+    if (metric == NULL) {
+      exit(EXIT_FAILURE);
+    }
+    metrics[n++] = metric;
+  }
+
+  *num_metrics = n;
+  return metrics;
+}
+
 double parse_double(const char *optarg, const char *name, int positive) {
   errno = 0;
   char *suffix = NULL;
@@ -528,6 +1514,18 @@ double parse_double(const char *optarg, const char *name, int positive) {
   return value;
 }
 
+unsigned parse_unsigned(const char *optarg, const char *name) {
+  errno = 0;
+  char *end = NULL;
+  const unsigned long value = strtoul(optarg, &end, 0);
+  if (errno == ERANGE || end == optarg || *end != '\0' || value > UINT_MAX) {
+    fprintf(stderr, "Could not parse --%s argument '%s'\n", name, optarg);
+    exit(EXIT_FAILURE);
+  }
+
+  return (unsigned)value;
+}
+
 int main(int argc, char *argv[]) {
   hwloc_topology_t topology = NULL;
   if (hwloc_topology_init(&topology)) {
@@ -549,17 +1547,54 @@ int main(int argc, char *argv[]) {
   enum policy { PARALLEL, ONE_BY_ONE, PAIR, NR_POLICIES };
 
   enum policy policy = ONE_BY_ONE;
+  enum wait_policy wait = WAIT_SPIN_FUTEX;
+  enum barrier_type barrier = BARRIER_PTHREAD;
+  enum timer_type timer = TIMER_ARCH;
+  const pmu_backend_t *pmu = get_pmu_backend_default();
+  pmu_config_t pmu_config = {0, 0};
+  sample_config_t sample_config = {0, NULL};
+  unsigned sample_top = 5;
+  warmup_config_t warmup = {0, 0, 10, 0.05};
+  int auto_warmup = 0;
+  unsigned warmup_max = 0;
+  double ci = 0.0;
+  unsigned max_iterations = 0;
   char *opt_benchmarks = NULL;
   char *opt_pmcs = NULL;
+  char *opt_metrics = NULL;
   unsigned iterations = 13;
   uint64_t size = l1.size;
+  unsigned linesize = l1.linesize;
+  int have_size = 0;
+  int have_level = 0;
+  unsigned level = 1;
+  double level_fraction = 1.0;
+  sweep_t sweep = {0, 0, 0, 0};
+  membind_t membind = {MEMBIND_DEFAULT, 0};
+  enum page_size pages = PAGES_DEFAULT;
+  enum color_policy color_policy = COLOR_DEFAULT;
+  cache_config_t cache = {CACHE_WARM, 0, 64};
   double fill = 0.9;
   double time = 20;
+  enum tune_core tune_core = TUNE_MEDIAN;
+  const char *tune_db = NULL;
   FILE *output = stdout;
   static int auto_tune = 0;
   static int tune = 0;
+  static int retune = 0;
   static int use_hyperthreads = 1;
   static int do_binding = 1;
+  static int lockstep = 0;
+  static int deadline = 0;
+  static int report_tsc = 0;
+  static int correct_tsc = 0;
+  static int print_ns = 0;
+  static int pmc_rotate = 0;
+  static int stream_results = 0;
+  static int online = 0;
+  static int lock_data = 0;
+  int binary = 0;
+  double period = 0;
   hwloc_cpuset_t cpuset1 = hwloc_bitmap_alloc();
   hwloc_cpuset_t cpuset2 = hwloc_bitmap_alloc();
   hwloc_cpuset_t runset = hwloc_bitmap_alloc();
@@ -573,13 +1608,50 @@ int main(int argc, char *argv[]) {
       {"cpuset-1", required_argument, NULL, 1},
       {"cpuset-2", required_argument, NULL, 2},
       {"size", required_argument, NULL, 's'},
+      {"level", required_argument, NULL, 'L'},
+      {"sweep", required_argument, NULL, 'Z'},
       {"fill", required_argument, NULL, 'f'},
+      {"membind", required_argument, NULL, 'N'},
+      {"pages", required_argument, NULL, 'H'},
+      {"mlock", no_argument, &lock_data, 1},
+      {"color-policy", required_argument, NULL, 'Y'},
+      {"cache", required_argument, NULL, 'A'},
+      {"pollution-size", required_argument, NULL, 'Q'},
       {"time", required_argument, NULL, 't'},
       {"tune", no_argument, &tune, 1},
       {"auto", no_argument, &auto_tune, 1},
+      {"tune-core", required_argument, NULL, 'c'},
+      {"tune-db", required_argument, NULL, 'd'},
+      {"retune", no_argument, &retune, 1},
       {"no-ht", no_argument, &use_hyperthreads, 0},
       {"disable-binding", no_argument, &do_binding, 0},
       {"pmcs", required_argument, NULL, 'm'},
+      {"wait", required_argument, NULL, 'w'},
+      {"barrier", required_argument, NULL, 'B'},
+      {"lockstep", no_argument, &lockstep, 1},
+      {"deadline", no_argument, &deadline, 1},
+      {"period", required_argument, NULL, 'P'},
+      {"tsc-report", no_argument, &report_tsc, 1},
+      {"tsc-correct", no_argument, &correct_tsc, 1},
+      {"timer", required_argument, NULL, 'T'},
+      {"pmu-backend", required_argument, NULL, 'M'},
+      {"pmc-group-size", required_argument, NULL, 'G'},
+      {"pmc-rotate", no_argument, &pmc_rotate, 1},
+      {"metrics", required_argument, NULL, 'D'},
+      {"list-metrics", no_argument, NULL, 3},
+      {"sample-period", required_argument, NULL, 'S'},
+      {"sample-event", required_argument, NULL, 'E'},
+      {"sample-top", required_argument, NULL, 'K'},
+      {"stream", no_argument, &stream_results, 1},
+      {"online", no_argument, &online, 1},
+      {"format", required_argument, NULL, 'F'},
+      {"ns", no_argument, &print_ns, 1},
+      {"warmup", required_argument, NULL, 'U'},
+      {"warmup-window", required_argument, NULL, 'W'},
+      {"warmup-cv", required_argument, NULL, 'V'},
+      {"warmup-max", required_argument, NULL, 'X'},
+      {"ci", required_argument, NULL, 'C'},
+      {"max-iterations", required_argument, NULL, 'I'},
       {NULL, 0, NULL, 0}};
 
   opterr = 0;
@@ -618,6 +1690,71 @@ int main(int argc, char *argv[]) {
     case 'b':
       opt_benchmarks = optarg;
       break;
+    case 'w':
+      if (strcmp(optarg, "spin") == 0) {
+        wait = WAIT_SPIN;
+      } else if (strcmp(optarg, "spin-then-futex") == 0) {
+        wait = WAIT_SPIN_FUTEX;
+      } else if (strcmp(optarg, "condvar") == 0) {
+        wait = WAIT_CONDVAR;
+      } else {
+        fprintf(stderr, "Unkown wait policy: %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'B':
+      if (strcmp(optarg, "pthread") == 0) {
+        barrier = BARRIER_PTHREAD;
+      } else if ((strcmp(optarg, "central") == 0) ||
+                 (strcmp(optarg, "centralized") == 0)) {
+        barrier = BARRIER_CENTRAL;
+      } else if (strcmp(optarg, "dissemination") == 0) {
+        barrier = BARRIER_DISSEMINATION;
+      } else if ((strcmp(optarg, "tournament") == 0) ||
+                 (strcmp(optarg, "tree") == 0)) {
+        barrier = BARRIER_TOURNAMENT;
+      } else {
+        fprintf(stderr, "Unkown barrier: %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'T':
+      if ((strcmp(optarg, "rdtscp-cpuid") == 0) ||
+          (strcmp(optarg, "arch") == 0)) {
+        timer = TIMER_ARCH;
+      } else if (strcmp(optarg, "lfence-rdtsc") == 0) {
+        timer = TIMER_LFENCE_RDTSC;
+      } else if (strcmp(optarg, "rdtscp") == 0) {
+        timer = TIMER_RDTSCP;
+      } else if ((strcmp(optarg, "clock_gettime") == 0) ||
+                 (strcmp(optarg, "clock-gettime") == 0)) {
+        timer = TIMER_CLOCK_GETTIME;
+      } else if (strcmp(optarg, "perf-cycles") == 0) {
+        timer = TIMER_PERF_CYCLES;
+      } else {
+        fprintf(stderr, "Unkown timer: %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'M':
+      pmu = get_pmu_backend_name(optarg);
+      if (pmu == NULL) {
+        fprintf(stderr, "Unkown PMU backend: %s. Available backends:\n",
+                optarg);
+        list_pmu_backends();
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'G': {
+      errno = 0;
+      unsigned long tmp = strtoul(optarg, NULL, 0);
+      if (errno == EINVAL || errno == ERANGE || tmp > UINT_MAX) {
+        fprintf(stderr, "Could not parse --pmc-group-size argument '%s': %s\n",
+                optarg, strerror(errno));
+        exit(EXIT_FAILURE);
+      }
+      pmu_config.group_size = (unsigned)tmp;
+    } break;
     case 'i': {
       errno = 0;
       unsigned long tmp = strtoul(optarg, NULL, 0);
@@ -633,6 +1770,76 @@ int main(int argc, char *argv[]) {
     case 'm':
       opt_pmcs = optarg;
       break;
+    case 'D':
+      opt_metrics = optarg;
+      break;
+    case 3:
+      list_metrics();
+      exit(EXIT_SUCCESS);
+    case 'S': {
+      errno = 0;
+      char *end = NULL;
+      unsigned long long tmp = strtoull(optarg, &end, 0);
+      if (errno == EINVAL || errno == ERANGE || *end != '\0') {
+        fprintf(stderr, "Could not parse --sample-period argument '%s'\n",
+                optarg);
+        exit(EXIT_FAILURE);
+      }
+      sample_config.period = (uint64_t)tmp;
+    } break;
+    case 'E':
+      sample_config.event = optarg;
+      break;
+    case 'F':
+      if (strcmp(optarg, "text") == 0) {
+        binary = 0;
+      } else if (strcmp(optarg, "binary") == 0) {
+        binary = 1;
+      } else {
+        fprintf(stderr, "Unkown format: %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'U':
+      if (strcmp(optarg, "auto") == 0) {
+        auto_warmup = 1;
+      } else {
+        auto_warmup = 0;
+        warmup.min = parse_unsigned(optarg, "warmup");
+      }
+      break;
+    case 'W':
+      warmup.window = parse_unsigned(optarg, "warmup-window");
+      break;
+    case 'V':
+      warmup.cv = parse_double(optarg, "warmup-cv", 1);
+      break;
+    case 'X':
+      warmup_max = parse_unsigned(optarg, "warmup-max");
+      break;
+    case 'C':
+      ci = parse_double(optarg, "ci", 1);
+      break;
+    case 'I':
+      max_iterations = parse_unsigned(optarg, "max-iterations");
+      break;
+    case 'L':
+      parse_level(optarg, &level, &level_fraction);
+      have_level = 1;
+      break;
+    case 'Z':
+      parse_sweep(optarg, &sweep);
+      break;
+    case 'K': {
+      errno = 0;
+      unsigned long tmp = strtoul(optarg, NULL, 0);
+      if (errno == EINVAL || errno == ERANGE || tmp > UINT_MAX) {
+        fprintf(stderr, "Could not parse --sample-top argument '%s': %s\n",
+                optarg, strerror(errno));
+        exit(EXIT_FAILURE);
+      }
+      sample_top = (unsigned)tmp;
+    } break;
     case 'o':
       if (strcmp(optarg, "-") == 0) {
         /* stdout is the default */
@@ -655,6 +1862,7 @@ int main(int argc, char *argv[]) {
       if (suffix != NULL) {
         size *= si_suffix_to_factor(*suffix);
       }
+      have_size = 1;
     } break;
     case 'f':
       fill = parse_double(optarg, "fill", 1);
@@ -662,6 +1870,85 @@ int main(int argc, char *argv[]) {
     case 't':
       time = parse_double(optarg, "time", 1);
       break;
+    case 'N':
+      if (strcmp(optarg, "local") == 0) {
+        membind.policy = MEMBIND_LOCAL;
+      } else if (strcmp(optarg, "interleave") == 0) {
+        membind.policy = MEMBIND_INTERLEAVE;
+      } else if (strcmp(optarg, "remote") == 0) {
+        membind.policy = MEMBIND_REMOTE;
+      } else if (strncmp(optarg, "node:", 5) == 0) {
+        membind.policy = MEMBIND_NODE;
+        membind.node = parse_unsigned(&optarg[5], "membind");
+      } else {
+        fprintf(stderr, "Unkown memory binding: %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'H':
+      if (strcmp(optarg, "4k") == 0) {
+        pages = PAGES_4K;
+      } else if (strcmp(optarg, "thp") == 0) {
+        pages = PAGES_THP;
+      } else if (strcmp(optarg, "2m") == 0) {
+        pages = PAGES_2M;
+      } else if (strcmp(optarg, "1g") == 0) {
+        pages = PAGES_1G;
+      } else {
+        fprintf(stderr, "Unkown page size: %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'Y':
+      if (strcmp(optarg, "random") == 0) {
+        color_policy = COLOR_RANDOM;
+      } else if (strcmp(optarg, "contiguous") == 0) {
+        color_policy = COLOR_CONTIGUOUS;
+      } else if (strcmp(optarg, "worst") == 0) {
+        color_policy = COLOR_WORST;
+      } else {
+        fprintf(stderr, "Unkown color policy: %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'A':
+      if (strcmp(optarg, "warm") == 0) {
+        cache.mode = CACHE_WARM;
+      } else if (strcmp(optarg, "cold") == 0) {
+        cache.mode = CACHE_COLD;
+      } else if (strcmp(optarg, "polluted") == 0) {
+        cache.mode = CACHE_POLLUTED;
+      } else {
+        fprintf(stderr, "Unkown cache mode: %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'Q': {
+      char *end = NULL;
+      cache.size = (size_t)parse_size(optarg, "pollution-size", &end);
+      if (*end != '\0' || cache.size == 0) {
+        fprintf(stderr, "Could not parse --pollution-size argument '%s'\n",
+                optarg);
+        exit(EXIT_FAILURE);
+      }
+    } break;
+    case 'c':
+      if (strcmp(optarg, "median") == 0) {
+        tune_core = TUNE_MEDIAN;
+      } else if (strcmp(optarg, "slowest") == 0) {
+        tune_core = TUNE_SLOWEST;
+      } else {
+        fprintf(stderr, "Unkown tuning core: %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'd':
+      tune_db = optarg;
+      break;
+    case 'P':
+      period = parse_double(optarg, "period", 1);
+      deadline = 1;
+      break;
     case ':':
       break;
     default:
@@ -669,6 +1956,54 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  pmu_config.rotate = pmc_rotate;
+  if ((pmu_config.rotate || pmu_config.group_size) && pmu != &perf_pmu) {
+    fprintf(stderr, "PMU backend %s ignores --pmc-group-size/--pmc-rotate.\n",
+            pmu->name);
+  }
+
+  if (binary && stream_results) {
+    fprintf(stderr, "--format=binary cannot be combined with --stream.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (auto_warmup) {
+    warmup.min = 0;
+    warmup.max = warmup_max ? warmup_max : 100;
+    if (warmup.window == 0) {
+      fprintf(stderr, "--warmup-window must be at least 1.\n");
+      exit(EXIT_FAILURE);
+    }
+    if (lockstep) {
+      /* Threads would leave the warm-up after different repetitions. */
+      fprintf(stderr, "--warmup=auto cannot be combined with --lockstep.\n");
+      exit(EXIT_FAILURE);
+    }
+  } else {
+    warmup.max = warmup.min;
+    warmup.window = 0;
+  }
+  /* With --ci, threads run between --iterations and --max-iterations. */
+  unsigned repetitions = iterations;
+  if (ci != 0.0) {
+    repetitions = max_iterations ? max_iterations : 1000;
+    if (repetitions < iterations) {
+      fprintf(stderr, "--max-iterations must be at least --iterations.\n");
+      exit(EXIT_FAILURE);
+    }
+    if (lockstep) {
+      fprintf(stderr, "--ci cannot be combined with --lockstep.\n");
+      exit(EXIT_FAILURE);
+    }
+  } else if (max_iterations) {
+    fprintf(stderr, "--max-iterations has no effect without --ci.\n");
+  }
+  if (binary && online) {
+    fprintf(stderr, "--format=binary cannot be combined with --online.\n");
+    exit(EXIT_FAILURE);
+  }
+  /* Everything but the results; not into a binary file. */
+  FILE *text = binary ? ((output == stdout) ? NULL : stdout) : output;
+
   {
     const int thissystem = hwloc_topology_is_thissystem(topology);
     fprintf(stderr, "Topology is from this system: %s",
@@ -730,39 +2065,14 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  benchmark_config_t config = {size, fill, l1.linesize, 1};
-
-  if (tune) {
-    const unsigned num_args = num_benchmarks + 1;
-    char **myargv = (char **)malloc(sizeof(char *) * num_args);
-    myargv[0] = ""; // the first arg for getopt to skip over.
-    fprintf(stderr, "Tuning rounds parameter:\n");
-    tune_benchmarks_time(benchmarks, num_benchmarks, myargv, 1,
-                         time, &config);
-    for (unsigned i = 1; i < num_args; ++i) {
-      free(myargv[i]);
+  unsigned num_metrics = 0;
+  struct metric **metrics = NULL;
+  if (opt_metrics != NULL) {
+    metrics = parse_metrics(opt_metrics, pmcs, num_pmcs, &num_metrics);
+    if (stream_results || online) {
+      fprintf(stderr,
+              "--metrics are not computed for --stream or --online results.\n");
     }
-    free(myargv);
-    exit(EXIT_SUCCESS);
-  }
-
-  if (auto_tune) {
-    /* alloc space for input argv + *-rounds= parameters */
-    unsigned idx = (unsigned)argc;
-    const unsigned num_args = num_benchmarks + idx;
-    char **myargv = (char **)malloc(sizeof(char *) * num_args);
-    memcpy(myargv, argv, idx * sizeof(char *));
-
-    tune_benchmarks_time(benchmarks, num_benchmarks, myargv, idx, time,
-                         &config);
-    config.verbose = 0;
-    init_benchmarks((int)(idx + num_benchmarks), myargv, &config);
-    for (unsigned i = (unsigned)argc; i < num_args; ++i) {
-      free(myargv[i]);
-    }
-    free(myargv);
-  } else {
-    init_benchmarks(argc, argv, &config);
   }
 
   if (policy >= NR_POLICIES) {
@@ -804,39 +2114,318 @@ int main(int argc, char *argv[]) {
   assert((policy == PAIR) == !hwloc_bitmap_iszero(cpuset2));
   hwloc_bitmap_or(runset, cpuset1, cpuset2);
 
+  if (have_level) {
+    if (have_size) {
+      fprintf(stderr, "--size and --level are exclusive.\n");
+      exit(EXIT_FAILURE);
+    }
+    /* Only one-by-one runs a single thread at a time. */
+    cache_level_t info;
+    if (level_size(topology, runset, level, policy != ONE_BY_ONE, &info)) {
+      fprintf(stderr, "Not all CPUs have an L%u cache.\n", level);
+      exit(EXIT_FAILURE);
+    }
+    size = (uint64_t)((double)info.size * level_fraction);
+    linesize = info.linesize;
+    if (level == LEVEL_DRAM) {
+      fprintf(stderr, "[Level] DRAMx%g: %" PRIu64 " bytes per thread, %ux the "
+              "%" PRIu64 " byte last level cache shared by %u threads\n",
+              level_fraction, size, DRAM_FACTOR, info.cache_size,
+              info.sharers);
+    } else {
+      fprintf(stderr, "[Level] L%ux%g: %" PRIu64 " bytes per thread, %" PRIu64
+              " byte cache shared by %u threads, line size: %u\n",
+              level, level_fraction, size, info.cache_size, info.sharers,
+              linesize);
+    }
+  }
+
+  /* Sizes per thread at which the cache levels end, for --sweep. */
+  uint64_t boundaries[8];
+  unsigned levels = 0;
+  if (sweep.points) {
+    if (have_size || have_level) {
+      fprintf(stderr, "--sweep cannot be combined with --size or --level.\n");
+      exit(EXIT_FAILURE);
+    }
+    cache_level_t info;
+    while (levels < sizeof(boundaries) / sizeof(boundaries[0]) &&
+           level_size(topology, runset, levels + 1, policy != ONE_BY_ONE,
+                      &info) == 0) {
+      boundaries[levels++] = info.size;
+    }
+    size = sweep_size(&sweep, 0);
+  }
+
+  benchmark_config_t config = {size, fill, linesize, 1};
+  if (benchmark_membind(topology, &membind)) {
+    exit(EXIT_FAILURE);
+  }
+  benchmark_pages(pages);
+  if (benchmark_colors(topology, color_policy)) {
+    exit(EXIT_FAILURE);
+  }
+  benchmark_mlock(lock_data);
+
   threads_t *workers = spawn_workers(topology, runset,
-          use_hyperthreads, do_binding);
+          use_hyperthreads, do_binding, wait, barrier, lockstep, timer,
+          pmu, &pmu_config, &sample_config);
 
   synchronize_worker_init(workers);
 
-  for (unsigned i = 0; i < num_benchmarks; ++i) {
-    benchmark_t *benchmark = benchmarks[i];
-
-    fprintf(stdout, "# %s\n", benchmark->name);
-
-    benchmark_result_t result;
-    switch (policy) {
-    case PARALLEL:
-      result =
-          run_in_parallel(workers, benchmark, iterations, pmcs, num_pmcs + 1);
-      break;
-    case ONE_BY_ONE:
-      result =
-          run_one_by_one(workers, benchmark, iterations, pmcs, num_pmcs + 1);
-      break;
-    case PAIR: {
-      const unsigned next = i + 1 < num_benchmarks ? i + 1 : i;
-      result =
-          run_two_benchmarks(workers, benchmarks[i], benchmarks[next], cpuset1,
-                             cpuset2, iterations, pmcs, num_pmcs + 1);
-      i = i + 1;
-    } break;
-    case NR_POLICIES:
+  double ns_per_tick = 0.0;
+  double metric_ns_per_tick = 0.0;
+  double frequency = 0.0;
+  if (print_ns || num_metrics || binary || tune || auto_tune) {
+    /* The dirigent's timer has been set up by synchronize_worker_init(). */
+    frequency = timer_frequency(&workers->threads[0].thread_arg.timer);
+    fprintf(stderr, "[Timer] frequency: %.0f Hz\n", frequency);
+    metric_ns_per_tick = 1e9 / frequency;
+    ns_per_tick = print_ns ? metric_ns_per_tick : 0.0;
+  }
+
+  /* --tune-db= without a file disables the tuning database. */
+  char *default_db = NULL;
+  if (tune_db == NULL) {
+    tune_db = default_db = tunedb_default_path();
+  } else if (*tune_db == '\0') {
+    tune_db = NULL;
+  }
+  char *tune_cpuset;
+  hwloc_bitmap_list_asprintf(&tune_cpuset, workers->cpuset);
+  tune_config_t tune_config = {time, tune_core, frequency, tune_db, retune,
+                               {NULL, NULL, NULL, NULL, 0, 0.0, tune_cpuset,
+                                0.0, NULL, 0}};
+  tunedb_key(&tune_config.key, topology);
+
+  if (tune) {
+    unsigned *rounds = (unsigned *)malloc(sizeof(unsigned) * num_benchmarks);
+    if (rounds == NULL) {
+      fprintf(stderr, "Error allocating memory\n");
+      exit(EXIT_FAILURE);
+    }
+    char *myargv[] = {(char *)""}; // the first arg for getopt to skip over.
+    fprintf(stderr, "Tuning rounds parameter:\n");
+    tune_benchmarks_time(workers, benchmarks, num_benchmarks, 1, myargv,
+                         &tune_config, &config, rounds);
+    free(rounds);
+    stop_workers(workers);
+    exit(EXIT_SUCCESS);
+  }
+
+  setup_benchmarks(workers, benchmarks, num_benchmarks, argc, argv, auto_tune,
+                   &tune_config, &config);
+
+  /* Not for the warm-up run and the tuning above. */
+  workers->sampling = sample_config.period != 0;
+  workers->online = online;
+  workers->warmup = warmup.max ? &warmup : NULL;
+  workers->ci = ci;
+  workers->min_reps = iterations;
+  cache.line_size = linesize;
+  workers->cache = (cache.mode != CACHE_WARM) ? &cache : NULL;
+
+  if (binary) {
+    char *xml = NULL;
+    int length = 0;
+#if HWLOC_API_VERSION >= 0x00020000
+    const int err = hwloc_topology_export_xmlbuffer(topology, &xml, &length, 0);
+#else
+    const int err = hwloc_topology_export_xmlbuffer(topology, &xml, &length);
+#endif
+    if (err) {
+      fprintf(stderr, "Exporting the topology failed, omitting it.\n");
+      xml = NULL;
+    }
+    char *setstr;
+    hwloc_bitmap_list_asprintf(&setstr, workers->cpuset);
+    resfile_write_header(output, frequency, tsc_frequency(), timer_name(timer),
+                         setstr, pmcs, num_pmcs, xml);
+    free(setstr);
+    if (xml) {
+      hwloc_free_xmlbuffer(topology, xml);
+    }
+  }
+
+  if (deadline || report_tsc || correct_tsc) {
+    fprintf(stderr, "[TSC] frequency: %.0f Hz\n", tsc_frequency());
+    workers->offsets = tsc_offsets(workers);
+    workers->correct = correct_tsc;
+  }
+
+  if (report_tsc) {
+    tsc_report(workers, workers->offsets);
+  }
+
+  if (deadline) {
+    /* Time between the dirigent publishing a deadline and the deadline. */
+    const double lead = 20e-6;
+    const double frequency = tsc_frequency();
+    workers->lead = (uint64_t)(lead * frequency);
+    workers->period = (uint64_t)(period * frequency);
+    workers->deadline = 1;
+  }
+
+  int *cpus = NULL;
+  if (stream_results || binary) {
+    const unsigned threads = (unsigned)hwloc_bitmap_weight(workers->cpuset);
+    cpus = (int *)malloc(sizeof(int) * threads);
+    if (cpus == NULL) {
+      fprintf(stderr, "Error allocating memory\n");
       exit(EXIT_FAILURE);
     }
+    int cpu = -1;
+    for (unsigned thread = 0; thread < threads; ++thread) {
+      cpus[thread] = cpu = hwloc_bitmap_next(workers->cpuset, cpu);
+    }
+  }
+
+  /* A duration summary per benchmark and sweep size. */
+  const unsigned points = sweep.points ? sweep.points : 1;
+  stats_summary_t *curve = (stats_summary_t *)calloc(
+      (size_t)num_benchmarks * points, sizeof(stats_summary_t));
+  if (curve == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (unsigned point = 0; point < points; ++point) {
+    if (sweep.points) {
+      /* The same workers for all sizes; only the benchmarks start over. */
+      if (point) {
+        config.size = sweep_size(&sweep, point);
+        setup_benchmarks(workers, benchmarks, num_benchmarks, argc, argv,
+                         auto_tune, &tune_config, &config);
+      }
+      if (!binary || output != stdout) {
+        fprintf(stdout, "# size: %" PRIu64 "\n", config.size);
+      }
+    }
+
+    for (unsigned i = 0; i < num_benchmarks; ++i) {
+      benchmark_t *benchmark = benchmarks[i];
+      const unsigned benchmark_idx = i; /* pairs advance i below */
+      /* Operations per repetition of every thread, for GFLOP/s; 0 if none. */
+      uint64_t flop = benchmark->flop;
+
+      if (!binary || output != stdout) {
+        fprintf(stdout, "# %s\n", benchmark->name);
+      }
+
+      if (stream_results) {
+        fprintf(output, "# stream: cpu rep start %s", print_ns ? "ns" : "ticks");
+        for (unsigned pmc = 0; pmc < num_pmcs; ++pmc) {
+          fprintf(output, " %s", pmcs[pmc]);
+        }
+        fprintf(output, "\n");
+        fflush(output);
+        workers->sink = sink_open(
+            output, (unsigned)hwloc_bitmap_weight(workers->cpuset), cpus,
+            num_pmcs + 1, ns_per_tick, topology, runset);
+      }
+
+      benchmark_result_t result;
+      switch (policy) {
+      case PARALLEL:
+        result =
+            run_in_parallel(workers, benchmark, repetitions, pmcs, num_pmcs + 1);
+        break;
+      case ONE_BY_ONE:
+        result =
+            run_one_by_one(workers, benchmark, repetitions, pmcs, num_pmcs + 1);
+        break;
+      case PAIR: {
+        const unsigned next = i + 1 < num_benchmarks ? i + 1 : i;
+        result =
+            run_two_benchmarks(workers, benchmarks[i], benchmarks[next], cpuset1,
+                               cpuset2, repetitions, pmcs, num_pmcs + 1);
+        if (benchmarks[next]->flop != flop) {
+          flop = 0;
+        }
+        i = i + 1;
+      } break;
+      case NR_POLICIES:
+        exit(EXIT_FAILURE);
+      }
+
+      if (policy != ONE_BY_ONE) {
+        fprintf(stderr, "[Barrier] %s release skew: %" PRIu64 "\n",
+                barrier_name(barrier), result.release_skew);
+      }
+      if (workers->warmup) {
+        warmup_print(result, workers->cpuset, workers->warmup);
+      }
+      if (workers->ci != 0.0) {
+        ci_print(result, workers->cpuset, workers->ci);
+      }
+
+      if (workers->sink) {
+        sink_close(workers->sink);
+        workers->sink = NULL;
+        if (online) {
+          stats_print(output, result, workers->cpuset, pmcs, ns_per_tick);
+        }
+      } else if (binary) {
+        char *name = NULL;
+        if (sweep.points && asprintf(&name, "%s@%" PRIu64, benchmark->name,
+                                     config.size) < 0) {
+          fprintf(stderr, "Error allocating memory\n");
+          exit(EXIT_FAILURE);
+        }
+        resfile_write_block(output, name ? name : benchmark->name,
+                            result.threads, result.repetitions,
+                            result.counters + 1, cpus, result.completed,
+                            result.data, result.starts);
+        free(name);
+      } else if (online) {
+        stats_print(output, result, workers->cpuset, pmcs, ns_per_tick);
+      } else {
+        result_print(output, result, workers->cpuset, pmcs, num_pmcs,
+                     ns_per_tick);
+      }
+      if (text && !stream_results && !online) {
+        metrics_print(text, result, workers->cpuset, metrics, num_metrics,
+                      metric_ns_per_tick);
+      }
+      if (text && !stream_results && !online && flop) {
+        if (metric_ns_per_tick == 0.0) {
+          frequency = timer_frequency(&workers->threads[0].thread_arg.timer);
+          metric_ns_per_tick = 1e9 / frequency;
+        }
+        /* Floating-point operations per ns are GFLOP/s. */
+        char expr[32];
+        snprintf(expr, sizeof(expr), "%" PRIu64 " / ns", flop);
+        struct metric *gflops =
+            metric_compile("GFLOP/s", expr, pmcs, num_pmcs);
+        metrics_print(text, result, workers->cpuset, &gflops, 1,
+                      metric_ns_per_tick);
+        metric_free(gflops);
+      }
+      if (text) {
+        samples_print(text, result, workers->cpuset, sample_top);
+      }
+      if (sweep.points) {
+        result_summarize(result, &curve[benchmark_idx * points + point]);
+      }
+      result_free(result);
+    }
+  }
 
-    result_print(output, result, workers->cpuset, pmcs, num_pmcs);
+  if (sweep.points && text) {
+    for (unsigned i = 0; i < num_benchmarks; ++i) {
+      int empty = 1;
+      for (unsigned point = 0; point < points; ++point) {
+        empty = empty && curve[i * points + point].count == 0;
+      }
+      if (!empty) {
+        sweep_print(text, benchmarks[i]->name, &sweep, &curve[i * points],
+                    boundaries, levels, ns_per_tick);
+      }
+    }
   }
+  free(curve);
+  free(tune_cpuset);
+  free(default_db);
 
   stop_workers(workers);
 }
@@ -0,0 +1,362 @@
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <metric.h>
+#include <pmu.h>
+
+/* Deepest stack an expression may need; plenty for hand-written metrics. */
+#define METRIC_MAX_DEPTH 32
+
+enum metric_op {
+  OP_CONST,
+  OP_EVENT,
+  OP_TICKS,
+  OP_NS,
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  OP_NEG
+};
+
+struct metric_instr {
+  enum metric_op op;
+  unsigned event; /* OP_EVENT: index into pmcs */
+  double value;   /* OP_CONST */
+};
+
+/* The expression in reverse polish notation. */
+struct metric {
+  char *name;
+  struct metric_instr *code;
+  unsigned length;
+};
+
+struct builtin_metric {
+  const char *name;
+  const char *expr;
+  const char *description;
+};
+
+/*
+ * Generic perf event names work with every backend that understands them;
+ * the architecture specific ones are libjevents or native event names.
+ */
+static const struct builtin_metric builtins[] = {
+    {"IPC", "instructions / cycles", "instructions per cycle"},
+    {"CPI", "cycles / instructions", "cycles per instruction"},
+    {"GHz", "cycles / ns", "average frequency of the core while measuring"},
+    {"BRANCH_MPKI", "1000 * branch-misses / instructions",
+     "branch mispredictions per 1000 instructions"},
+    {"CACHE_MPKI", "1000 * cache-misses / instructions",
+     "last level cache misses per 1000 instructions"},
+    {"FRONTEND_STALLS", "stalled-cycles-frontend / cycles",
+     "fraction of cycles the frontend stalled"},
+    {"BACKEND_STALLS", "stalled-cycles-backend / cycles",
+     "fraction of cycles the backend stalled"},
+#if defined(__x86_64__)
+    {"TURBO", "cycles / ref-cycles",
+     "actual over nominal frequency; below 1 means throttling"},
+    {"L1D_MPKI", "1000 * L1D.REPLACEMENT / instructions",
+     "L1D lines replaced per 1000 instructions"},
+    {"L2_MPKI", "1000 * L2_RQSTS.MISS / instructions",
+     "L2 misses per 1000 instructions"},
+    {"MEM_STALLS", "CYCLE_ACTIVITY.STALLS_MEM_ANY / cycles",
+     "fraction of cycles stalled on outstanding loads"},
+#elif defined(__aarch64__)
+    {"L1D_MISS_RATIO", "L1D_CACHE_REFILL / L1D_CACHE",
+     "L1D refills per L1D access"},
+    {"L2D_MISS_RATIO", "L2D_CACHE_REFILL / L2D_CACHE",
+     "L2D refills per L2D access"},
+    {"L1D_REFILLS_PER_ACCESS", "L1D_CACHE_REFILL / MEM_ACCESS",
+     "L1D refills per memory access"},
+#endif
+};
+
+static unsigned number_builtins(void) {
+  return sizeof(builtins) / sizeof(builtins[0]);
+}
+
+struct parser {
+  const char *expr;
+  const char *pos;
+  const char **pmcs;
+  unsigned num_pmcs;
+  struct metric_instr *code;
+  unsigned length;
+  unsigned depth;
+  unsigned max_depth;
+  int quiet;
+  int error;
+};
+
+static void parse_error(struct parser *p, const char *what) {
+  if (!p->error && !p->quiet) {
+    fprintf(stderr, "[Metric] %s at offset %u of \"%s\"\n", what,
+            (unsigned)(p->pos - p->expr), p->expr);
+  }
+  p->error = 1;
+}
+
+/* Binary operators take two operands and leave one. */
+static void emit(struct parser *p, const enum metric_op op,
+                 const unsigned event, const double value) {
+  struct metric_instr *instr = &p->code[p->length++];
+  instr->op = op;
+  instr->event = event;
+  instr->value = value;
+
+  switch (op) {
+  case OP_CONST:
+  case OP_EVENT:
+  case OP_TICKS:
+  case OP_NS:
+    if (++p->depth > p->max_depth) {
+      p->max_depth = p->depth;
+    }
+    break;
+  case OP_NEG:
+    break;
+  default:
+    --p->depth;
+    break;
+  }
+}
+
+static void skip_space(struct parser *p) {
+  while (isspace((unsigned char)*p->pos)) {
+    ++p->pos;
+  }
+}
+
+static int is_name_char(const char c) {
+  return isalnum((unsigned char)c) || c == '_' || c == '.' || c == ':' ||
+         c == '-';
+}
+
+static void parse_expr(struct parser *p);
+
+static void parse_identifier(struct parser *p) {
+  const char *begin = p->pos;
+  while (is_name_char(*p->pos)) {
+    ++p->pos;
+  }
+  const size_t length = (size_t)(p->pos - begin);
+
+  if (length == 5 && strncmp(begin, "ticks", length) == 0) {
+    emit(p, OP_TICKS, 0, 0.0);
+    return;
+  }
+  if (length == 2 && strncmp(begin, "ns", length) == 0) {
+    emit(p, OP_NS, 0, 0.0);
+    return;
+  }
+  for (unsigned i = 0; i < p->num_pmcs; ++i) {
+    if (strlen(p->pmcs[i]) == length &&
+        strncmp(begin, p->pmcs[i], length) == 0) {
+      emit(p, OP_EVENT, i, 0.0);
+      return;
+    }
+  }
+
+  if (!p->error && !p->quiet) {
+    fprintf(stderr, "[Metric] event %.*s of \"%s\" is not counted (--pmcs)\n",
+            (int)length, begin, p->expr);
+  }
+  p->error = 1;
+}
+
+static void parse_factor(struct parser *p) {
+  skip_space(p);
+  const char c = *p->pos;
+
+  if (c == '-') {
+    ++p->pos;
+    parse_factor(p);
+    emit(p, OP_NEG, 0, 0.0);
+  } else if (c == '(') {
+    ++p->pos;
+    parse_expr(p);
+    skip_space(p);
+    if (*p->pos != ')') {
+      parse_error(p, "missing ')'");
+      return;
+    }
+    ++p->pos;
+  } else if (isdigit((unsigned char)c) || c == '.') {
+    char *end = NULL;
+    const double value = strtod(p->pos, &end);
+    p->pos = end;
+    emit(p, OP_CONST, 0, value);
+  } else if (isalpha((unsigned char)c) || c == '_') {
+    parse_identifier(p);
+  } else {
+    parse_error(p, "expected a number, an event or '('");
+  }
+}
+
+static void parse_term(struct parser *p) {
+  parse_factor(p);
+  while (!p->error) {
+    skip_space(p);
+    const char c = *p->pos;
+    if (c != '*' && c != '/') {
+      break;
+    }
+    ++p->pos;
+    parse_factor(p);
+    emit(p, (c == '*') ? OP_MUL : OP_DIV, 0, 0.0);
+  }
+}
+
+static void parse_expr(struct parser *p) {
+  parse_term(p);
+  while (!p->error) {
+    skip_space(p);
+    const char c = *p->pos;
+    if (c != '+' && c != '-') {
+      break;
+    }
+    ++p->pos;
+    parse_term(p);
+    emit(p, (c == '+') ? OP_ADD : OP_SUB, 0, 0.0);
+  }
+}
+
+static struct metric *compile(const char *name, const char *expr,
+                              const char **pmcs, const unsigned num_pmcs,
+                              const int quiet) {
+  /* Every character yields at most one instruction, unary minus included. */
+  struct parser p = {expr, expr, pmcs, num_pmcs, NULL, 0, 0, 0, quiet, 0};
+  p.code = (struct metric_instr *)malloc(sizeof(struct metric_instr) *
+                                         (strlen(expr) + 1));
+  if (p.code == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  parse_expr(&p);
+  skip_space(&p);
+  if (!p.error && *p.pos != '\0') {
+    parse_error(&p, "unexpected character");
+  }
+  if (!p.error && p.max_depth > METRIC_MAX_DEPTH) {
+    parse_error(&p, "expression nested too deeply");
+  }
+  if (p.error) {
+    free(p.code);
+    return NULL;
+  }
+
+  struct metric *metric = (struct metric *)malloc(sizeof(struct metric));
+  if (metric == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+  metric->name = strdup(name);
+  metric->code = p.code;
+  metric->length = p.length;
+  return metric;
+}
+
+struct metric *metric_compile(const char *name, const char *expr,
+                              const char **pmcs, const unsigned num_pmcs) {
+  return compile(name, expr, pmcs, num_pmcs, 0);
+}
+
+void metric_free(struct metric *metric) {
+  free(metric->name);
+  free(metric->code);
+  free(metric);
+}
+
+const char *metric_name(const struct metric *metric) { return metric->name; }
+
+double metric_eval(const struct metric *metric, const uint64_t *sample,
+                   const double ns_per_tick) {
+  double stack[METRIC_MAX_DEPTH];
+  unsigned top = 0;
+
+  for (unsigned i = 0; i < metric->length; ++i) {
+    const struct metric_instr *instr = &metric->code[i];
+    switch (instr->op) {
+    case OP_CONST:
+      stack[top++] = instr->value;
+      break;
+    case OP_EVENT: {
+      const uint64_t value = sample[instr->event + 1];
+      if (value == PMU_NOT_COUNTED) {
+        return NAN;
+      }
+      stack[top++] = (double)value;
+    } break;
+    case OP_TICKS:
+      stack[top++] = (double)sample[0];
+      break;
+    case OP_NS:
+      stack[top++] = (double)sample[0] * ns_per_tick;
+      break;
+    case OP_ADD:
+      --top;
+      stack[top - 1] += stack[top];
+      break;
+    case OP_SUB:
+      --top;
+      stack[top - 1] -= stack[top];
+      break;
+    case OP_MUL:
+      --top;
+      stack[top - 1] *= stack[top];
+      break;
+    case OP_DIV:
+      --top;
+      if (stack[top] == 0.0) {
+        return NAN;
+      }
+      stack[top - 1] /= stack[top];
+      break;
+    case OP_NEG:
+      stack[top - 1] = -stack[top - 1];
+      break;
+    }
+  }
+
+  return stack[0];
+}
+
+const char *metric_builtin(const char *name) {
+  for (unsigned i = 0; i < number_builtins(); ++i) {
+    if (strcmp(name, builtins[i].name) == 0) {
+      return builtins[i].expr;
+    }
+  }
+  return NULL;
+}
+
+int metric_builtin_available(const char *name, const char **pmcs,
+                             const unsigned num_pmcs) {
+  const char *expr = metric_builtin(name);
+  if (expr == NULL) {
+    return 0;
+  }
+  struct metric *metric = compile(name, expr, pmcs, num_pmcs, 1);
+  if (metric == NULL) {
+    return 0;
+  }
+  metric_free(metric);
+  return 1;
+}
+
+const char *metric_builtin_idx(const unsigned idx) {
+  return (idx < number_builtins()) ? builtins[idx].name : NULL;
+}
+
+void list_metrics(void) {
+  for (unsigned i = 0; i < number_builtins(); ++i) {
+    fprintf(stdout, "%-16s %-40s %s\n", builtins[i].name, builtins[i].expr,
+            builtins[i].description);
+  }
+}
@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <config.h>
+
+#include <arch.h>
+#include <mckernel.h>
+#include <pmu.h>
+
+static struct pmu *none_init(const char **pmcs, const unsigned num_pmcs,
+                             const unsigned cpu, const pmu_config_t *config) {
+  if (num_pmcs) {
+    fprintf(stderr, "PMU backend \"none\" cannot count events.\n");
+    exit(EXIT_FAILURE);
+  }
+  return NULL;
+}
+static void none_free(struct pmu *pmu) {}
+static void none_begin(struct pmu *pmu, uint64_t *data) {}
+static void none_end(struct pmu *pmu, uint64_t *data) {}
+
+const pmu_backend_t none_pmu = {"none", none_init, none_free, none_begin,
+                                none_end};
+
+#ifdef ARCH_HAVE_PMU
+static struct pmu *arch_init(const char **pmcs, const unsigned num_pmcs,
+                             const unsigned cpu, const pmu_config_t *config) {
+  return arch_pmu_init(pmcs, num_pmcs, cpu);
+}
+
+const pmu_backend_t arch_pmu = {"arch", arch_init, arch_pmu_free,
+                                arch_pmu_begin, arch_pmu_end};
+#endif
+
+/* In order of preference; the first one is the default. */
+static const pmu_backend_t *const backends[] = {
+#ifdef ARCH_HAVE_PMU
+    &arch_pmu,
+#endif
+#ifdef __linux__
+    &perf_pmu,
+#endif
+#if defined(__x86_64__) && defined(JEVENTS_FOUND)
+    &jevents_pmu,
+#endif
+#if defined(__x86_64__) && defined(__linux__)
+    &rawmsr_pmu,
+#endif
+    &none_pmu};
+
+static unsigned number_pmu_backends(void) {
+  return sizeof(backends) / sizeof(backends[0]);
+}
+
+const pmu_backend_t *get_pmu_backend_default(void) {
+#if defined(__x86_64__) && defined(JEVENTS_FOUND)
+  /* McKernel has no perf_event_open(2). */
+  if (mck_is_mckernel()) {
+    return &jevents_pmu;
+  }
+#endif
+  return backends[0];
+}
+
+const pmu_backend_t *get_pmu_backend_name(const char *const name) {
+  for (unsigned i = 0; i < number_pmu_backends(); ++i) {
+    if (strcasecmp(name, backends[i]->name) == 0) {
+      return backends[i];
+    }
+  }
+  return NULL;
+}
+
+void list_pmu_backends(void) {
+  for (unsigned i = 0; i < number_pmu_backends(); ++i) {
+    fprintf(stdout, "%s\n", backends[i]->name);
+  }
+}
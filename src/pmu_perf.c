@@ -0,0 +1,439 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <config.h>
+
+#ifdef __linux__
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#if defined(__x86_64__) && defined(JEVENTS_FOUND)
+#include <jevents.h>
+#endif
+
+#include <arch.h>
+#include <pmu.h>
+
+struct generic_event {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+};
+
+/* The names perf(1) uses for the generic events. */
+static const struct generic_event generic_events[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"cpu-cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"cache-references", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES},
+    {"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"branches", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS},
+    {"branch-instructions", PERF_TYPE_HARDWARE,
+     PERF_COUNT_HW_BRANCH_INSTRUCTIONS},
+    {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"bus-cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BUS_CYCLES},
+    {"stalled-cycles-frontend", PERF_TYPE_HARDWARE,
+     PERF_COUNT_HW_STALLED_CYCLES_FRONTEND},
+    {"stalled-cycles-backend", PERF_TYPE_HARDWARE,
+     PERF_COUNT_HW_STALLED_CYCLES_BACKEND},
+    {"ref-cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_REF_CPU_CYCLES},
+    {"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+    {"minor-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MIN},
+    {"major-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MAJ},
+    {"context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+    {"cpu-migrations", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS},
+    {"cpu-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK},
+    {"task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+};
+
+int perf_event_parse(const char *const name, struct perf_event_attr *attr) {
+  memset(attr, 0, sizeof(*attr));
+  attr->size = sizeof(*attr);
+
+  const unsigned num_events = sizeof(generic_events) / sizeof(generic_events[0]);
+  for (unsigned i = 0; i < num_events; ++i) {
+    if (strcasecmp(name, generic_events[i].name) == 0) {
+      attr->type = generic_events[i].type;
+      attr->config = generic_events[i].config;
+      return 0;
+    }
+  }
+
+  /* rXXXX: raw, model-specific event code */
+  if (name[0] == 'r' && name[1] != '\0') {
+    char *end = NULL;
+    errno = 0;
+    const unsigned long long config = strtoull(&name[1], &end, 16);
+    if (errno == 0 && *end == '\0') {
+      attr->type = PERF_TYPE_RAW;
+      attr->config = config;
+      return 0;
+    }
+  }
+
+#if defined(__x86_64__) && defined(JEVENTS_FOUND)
+  if (resolve_event(name, attr) == 0) {
+    return 0;
+  }
+#endif
+
+  return -1;
+}
+
+/*
+ * perf_event_open(2): the requested events are opened in groups on the
+ * calling thread, user space only. A group is always scheduled onto the PMU
+ * as a whole; the next group starts when an event does not fit anymore or
+ * config->group_size is reached. Values are deltas of two snapshots. If the
+ * kernel permits, a snapshot reads the counters of a group back to back with
+ * rdpmc from user space; otherwise it is a single read(2) of the leader.
+ *
+ * With more than one group either all of them count and the kernel
+ * time-slices them, so values are scaled by the time a group was enabled
+ * over the time it actually counted, or, with config->rotate, one group
+ * after the other counts a whole repetition and the others report
+ * PMU_NOT_COUNTED.
+ */
+
+/* State of one member's mmap'd page during a snapshot. */
+struct perf_member {
+  struct perf_event_mmap_page *page;
+  uint32_t seq;
+  uint32_t index; /* hardware counter + 1, or 0 if not on the PMU */
+  uint64_t offset;
+  unsigned width;
+};
+
+struct perf_group {
+  int *fds;        /* fds[0] is the group leader */
+  unsigned *slots; /* index of each member's value in data[] */
+  struct perf_member *members;
+  int rdpmc;        /* all members can be read with rdpmc */
+  uint64_t *buffer; /* read(2): nr, time_enabled, time_running, values[nr] */
+  uint64_t *values; /* scratch space for one snapshot */
+  uint64_t enabled; /* time_enabled and time_running at begin */
+  uint64_t running;
+  unsigned active;
+};
+
+struct perf_pmu {
+  struct perf_group *groups;
+  unsigned num_groups;
+  int rotate;
+  unsigned current; /* group counting this repetition if rotating */
+};
+
+static long page_size(void) { return sysconf(_SC_PAGESIZE); }
+
+/* Whether the counter behind attr can be read with rdpmc at all. */
+static int counts_on_pmu(const struct perf_event_attr *attr) {
+  return attr->type == PERF_TYPE_HARDWARE || attr->type == PERF_TYPE_RAW ||
+         attr->type == PERF_TYPE_HW_CACHE;
+}
+
+static void perf_group_alloc(struct perf_group *group,
+                             const unsigned num_pmcs) {
+  group->fds = (int *)malloc(sizeof(int) * num_pmcs);
+  group->slots = (unsigned *)malloc(sizeof(unsigned) * num_pmcs);
+  group->members =
+      (struct perf_member *)calloc(num_pmcs, sizeof(struct perf_member));
+  group->buffer = (uint64_t *)malloc(sizeof(uint64_t) * (num_pmcs + 3));
+  group->values = (uint64_t *)malloc(sizeof(uint64_t) * num_pmcs);
+  if (group->fds == NULL || group->slots == NULL || group->members == NULL ||
+      group->buffer == NULL || group->values == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+  group->active = 0;
+  group->enabled = 0;
+  group->running = 0;
+#ifdef __x86_64__
+  group->rdpmc = 1;
+#else
+  group->rdpmc = 0;
+#endif
+}
+
+/**
+ * Open the event attr as the next member of group, for data[slot].
+ *
+ * @return 0 on success, -1 with errno set otherwise
+ **/
+static int perf_group_add(struct perf_group *group,
+                          struct perf_event_attr *attr, const unsigned slot,
+                          const int rotate) {
+  attr->exclude_kernel = 1;
+  attr->exclude_hv = 1;
+  attr->read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                      PERF_FORMAT_TOTAL_TIME_RUNNING;
+  /* Rotating groups count only while it is their turn. */
+  attr->disabled = (rotate && group->active == 0) ? 1 : 0;
+  const int leader = group->active ? group->fds[0] : -1;
+  const int fd = (int)syscall(__NR_perf_event_open, attr, 0, -1, leader, 0);
+  if (fd < 0) {
+    return -1;
+  }
+
+  struct perf_member *member = &group->members[group->active];
+  group->slots[group->active] = slot;
+  group->fds[group->active++] = fd;
+
+  if (!counts_on_pmu(attr)) {
+    group->rdpmc = 0;
+  }
+  if (group->rdpmc) {
+    void *page =
+        mmap(NULL, (size_t)page_size(), PROT_READ, MAP_SHARED, fd, 0);
+    if (page == MAP_FAILED) {
+      group->rdpmc = 0;
+    } else {
+      member->page = (struct perf_event_mmap_page *)page;
+      group->rdpmc = member->page->cap_user_rdpmc;
+    }
+  }
+
+  return 0;
+}
+
+static void perf_group_close(struct perf_group *group) {
+  for (unsigned i = 0; i < group->active; ++i) {
+    if (group->members[i].page) {
+      munmap(group->members[i].page, (size_t)page_size());
+    }
+    close(group->fds[i]);
+  }
+  free(group->fds);
+  free(group->slots);
+  free(group->members);
+  free(group->buffer);
+  free(group->values);
+}
+
+#ifdef __x86_64__
+/*
+ * The self-monitoring protocol of perf_event_open(2) for all members at
+ * once: collect the counter indices first, so that the rdpmc instructions
+ * follow each other directly, and retry if the kernel touched any page.
+ * The times in the pages are only updated when the group is scheduled in or
+ * out; they are extended to now with the TSC conversion of cap_user_time,
+ * and running only while the group is on the PMU. Groups without it are read
+ * with read(2) if they may be multiplexed, see perf_init().
+ */
+static void perf_group_rdpmc(struct perf_group *group, uint64_t *values,
+                             uint64_t *enabled, uint64_t *running) {
+  struct perf_member *members = group->members;
+  const unsigned active = group->active;
+  int retry;
+
+  do {
+    for (unsigned i = 0; i < active; ++i) {
+      const volatile struct perf_event_mmap_page *pc = members[i].page;
+      members[i].seq = pc->lock;
+    }
+    __asm__ volatile("" ::: "memory");
+    for (unsigned i = 0; i < active; ++i) {
+      const volatile struct perf_event_mmap_page *pc = members[i].page;
+      members[i].index = pc->index;
+      members[i].offset = (uint64_t)pc->offset;
+      members[i].width = pc->pmc_width;
+    }
+    {
+      const volatile struct perf_event_mmap_page *pc = members[0].page;
+      *enabled = pc->time_enabled;
+      *running = pc->time_running;
+      if (pc->cap_user_time) {
+        const uint64_t cycles = arch_timestamp_rdtscp();
+        const unsigned shift = pc->time_shift;
+        const uint64_t mult = pc->time_mult;
+        const uint64_t quot = cycles >> shift;
+        const uint64_t rem = cycles & (((uint64_t)1 << shift) - 1);
+        const uint64_t delta =
+            pc->time_offset + quot * mult + ((rem * mult) >> shift);
+        *enabled += delta;
+        if (pc->index) {
+          *running += delta;
+        }
+      }
+    }
+
+    for (unsigned i = 0; i < active; ++i) {
+      values[i] = members[i].index ? arch_rdpmc(members[i].index - 1) : 0;
+    }
+
+    __asm__ volatile("" ::: "memory");
+    retry = 0;
+    for (unsigned i = 0; i < active; ++i) {
+      const volatile struct perf_event_mmap_page *pc = members[i].page;
+      retry |= pc->lock != members[i].seq;
+    }
+  } while (retry);
+
+  for (unsigned i = 0; i < active; ++i) {
+    uint64_t count = members[i].offset;
+    if (members[i].index) {
+      const unsigned shift = 64U - members[i].width;
+      count += (uint64_t)((int64_t)(values[i] << shift) >> shift);
+    }
+    values[i] = count;
+  }
+}
+#endif
+
+static void perf_group_read(struct perf_group *group, uint64_t *values,
+                            uint64_t *enabled, uint64_t *running) {
+#ifdef __x86_64__
+  if (group->rdpmc) {
+    perf_group_rdpmc(group, values, enabled, running);
+    return;
+  }
+#endif
+
+  const size_t size = sizeof(uint64_t) * (group->active + 3);
+  if (read(group->fds[0], group->buffer, size) != (ssize_t)size) {
+    fprintf(stderr, "Reading perf_event group failed: %s\n", strerror(errno));
+    return;
+  }
+  *enabled = group->buffer[1];
+  *running = group->buffer[2];
+  memcpy(values, &group->buffer[3], sizeof(uint64_t) * group->active);
+}
+
+static struct pmu *perf_init(const char **pmcs, const unsigned num_pmcs,
+                             const unsigned cpu, const pmu_config_t *config) {
+  struct perf_pmu *pmus = (struct perf_pmu *)malloc(sizeof(struct perf_pmu));
+  if (pmus == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+  pmus->groups =
+      (struct perf_group *)calloc(num_pmcs, sizeof(struct perf_group));
+  if (pmus->groups == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+  pmus->num_groups = 0;
+  pmus->rotate = config ? config->rotate : 0;
+  pmus->current = 0;
+
+  const unsigned group_size = config ? config->group_size : 0;
+  struct perf_group *group = NULL;
+  for (unsigned i = 0; i < num_pmcs; ++i) {
+    struct perf_event_attr attr;
+    const char *event = pmcs[i];
+    if (perf_event_parse(event, &attr)) {
+      fprintf(stderr, "Error resolving event: \"%s\".\n", event);
+      continue;
+    }
+
+    /* The kernel refuses a member if the group would not fit the PMU. */
+    const int room = group && (group_size == 0 || group->active < group_size);
+    if (room && perf_group_add(group, &attr, i, pmus->rotate) == 0) {
+      continue;
+    }
+
+    struct perf_group *next = &pmus->groups[pmus->num_groups];
+    perf_group_alloc(next, num_pmcs);
+    if (perf_group_add(next, &attr, i, pmus->rotate)) {
+      fprintf(stderr, "perf_event_open() failed for \"%s\": %s\n", event,
+              strerror(errno));
+      perf_group_close(next);
+      continue;
+    }
+    group = next;
+    ++pmus->num_groups;
+  }
+
+  /* Multiplexed groups need times that are current at every snapshot. */
+  if (pmus->num_groups > 1 && !pmus->rotate) {
+    for (unsigned g = 0; g < pmus->num_groups; ++g) {
+      struct perf_group *multiplexed = &pmus->groups[g];
+      if (multiplexed->rdpmc && !multiplexed->members[0].page->cap_user_time) {
+        multiplexed->rdpmc = 0;
+      }
+    }
+  }
+
+  return (struct pmu *)pmus;
+}
+
+static void perf_free(struct pmu *pmu) {
+  struct perf_pmu *pmus = (struct perf_pmu *)pmu;
+
+  for (unsigned g = 0; g < pmus->num_groups; ++g) {
+    perf_group_close(&pmus->groups[g]);
+  }
+  free(pmus->groups);
+  free(pmus);
+}
+
+static void perf_begin(struct pmu *pmu, uint64_t *data) {
+  struct perf_pmu *pmus = (struct perf_pmu *)pmu;
+
+  for (unsigned g = 0; g < pmus->num_groups; ++g) {
+    struct perf_group *group = &pmus->groups[g];
+    if (pmus->rotate) {
+      if (g != pmus->current) {
+        continue;
+      }
+      ioctl(group->fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+
+    perf_group_read(group, group->values, &group->enabled, &group->running);
+    for (unsigned i = 0; i < group->active; ++i) {
+      data[group->slots[i]] = group->values[i];
+    }
+  }
+}
+
+static void perf_end(struct pmu *pmu, uint64_t *data) {
+  struct perf_pmu *pmus = (struct perf_pmu *)pmu;
+
+  for (unsigned g = 0; g < pmus->num_groups; ++g) {
+    struct perf_group *group = &pmus->groups[g];
+    if (pmus->rotate && g != pmus->current) {
+      for (unsigned i = 0; i < group->active; ++i) {
+        data[group->slots[i]] = PMU_NOT_COUNTED;
+      }
+      continue;
+    }
+
+    uint64_t enabled = group->enabled;
+    uint64_t running = group->running;
+    perf_group_read(group, group->values, &enabled, &running);
+    enabled -= group->enabled;
+    running -= group->running;
+
+    for (unsigned i = 0; i < group->active; ++i) {
+      uint64_t *value = &data[group->slots[i]];
+      const uint64_t delta = group->values[i] - *value;
+      if (running == 0 && enabled > 0) {
+        /* Enabled, but never got onto the PMU. */
+        *value = PMU_NOT_COUNTED;
+      } else if (running < enabled) {
+        *value = (uint64_t)((double)delta * (double)enabled / (double)running +
+                            0.5);
+      } else {
+        *value = delta;
+      }
+    }
+
+    if (pmus->rotate) {
+      ioctl(group->fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    }
+  }
+
+  if (pmus->rotate && pmus->num_groups) {
+    pmus->current = (pmus->current + 1) % pmus->num_groups;
+  }
+}
+
+const pmu_backend_t perf_pmu = {"perf", perf_init, perf_free, perf_begin,
+                                perf_end};
+
+#endif /* __linux__ */
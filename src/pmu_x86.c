@@ -0,0 +1,324 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <config.h>
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#ifdef JEVENTS_FOUND
+#include <jevents.h>
+#include <rdpmc.h>
+#endif
+
+#include <arch.h>
+#include <mckernel.h>
+#include <pmu.h>
+
+enum msrs {
+  IA32_PMC_BASE = 0x0c1,
+  IA32_PERFEVTSEL_BASE = 0x186,
+  IA32_FIXED_CTR_CTRL = 0x38d,
+  IA32_PERF_GLOBAL_STATUS = 0x38e,
+  IA32_PERF_GLOBAL_CTRL = 0x38f,
+  IA32_PERF_GLOBAL_OVF_CTRL = 0x390,
+  IA32_PERF_CAPABILITIES = 0x345,
+  IA32_DEBUGCTL = 0x1d9,
+};
+
+/* Under McKernel MSRs are accessed with system calls; fd is unused. */
+static uint64_t rdmsr(const uint32_t idx, const int mckernel, const int fd) {
+  if (mckernel) {
+    return (uint64_t)syscall(850, idx);
+  } else {
+    uint64_t v = 0;
+    const ssize_t ret = pread(fd, &v, sizeof(v), idx);
+    if (ret != sizeof(v)) {
+      fprintf(stderr, "Reading MSR %x failed\n", idx);
+    }
+    return v;
+  }
+}
+
+static void wrmsr(const uint32_t idx, const uint64_t val, const int mckernel,
+                  const int fd) {
+  if (mckernel) {
+    syscall(851, idx, val);
+  } else {
+    const ssize_t ret = pwrite(fd, &val, sizeof(val), idx);
+    if (ret != sizeof(val)) {
+      fprintf(stderr, "Writing MSR %x failed\n", idx);
+    }
+  }
+}
+
+static inline void cpuid(const int code, uint32_t *a, uint32_t *b, uint32_t *c,
+                         uint32_t *d) {
+  __asm__ volatile("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(code));
+}
+
+#define MASK(v, high, low) ((v >> low) & ((1 << (high - low + 1)) - 1))
+
+#ifdef JEVENTS_FOUND
+
+/*
+ * libjevents: counters are set up with perf_event_open(2) and read with
+ * rdpmc. McKernel has no perf_event_open(2); its PMC system calls are used
+ * with the same event encoding instead.
+ */
+
+struct jevents_pmu {
+  struct rdpmc_ctx *ctx;
+  unsigned active;
+  int mckernel;
+  uint64_t global_ctrl;
+};
+
+static struct pmu *jevents_init(const char **pmcs, const unsigned num_pmcs,
+                                const unsigned cpu,
+                                const pmu_config_t *config) {
+  struct jevents_pmu *pmus =
+      (struct jevents_pmu *)malloc(sizeof(struct jevents_pmu));
+  if (pmus == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+  pmus->ctx = (struct rdpmc_ctx *)malloc(sizeof(struct rdpmc_ctx) * num_pmcs);
+  pmus->active = 0;
+  pmus->mckernel = mck_is_mckernel();
+  pmus->global_ctrl = 0;
+
+  if (pmus->mckernel) {
+    pmus->global_ctrl = rdmsr(IA32_PERF_GLOBAL_CTRL, 1, -1);
+  }
+
+  for (unsigned i = 0; i < num_pmcs; ++i) {
+    struct perf_event_attr attr;
+    const char *event = pmcs[i];
+    int err = perf_event_parse(event, &attr);
+    if (err) {
+      fprintf(stderr, "Error resolving event: \"%s\".\n", event);
+      continue;
+    }
+
+    if (pmus->mckernel) {
+      err = mck_pmc_init((int)pmus->active, (int)attr.config, 0x4);
+      if (err) {
+        fprintf(stderr, "Error configuring PMU with \"%s\" %llx\n", event,
+                (unsigned long long)attr.config);
+        continue;
+      }
+    } else {
+      /* Schedule all counters together, like the perf backend. */
+      struct rdpmc_ctx *leader = pmus->active ? &pmus->ctx[0] : NULL;
+      err = rdpmc_open_attr(&attr, &pmus->ctx[pmus->active], leader);
+      if (err) {
+        fprintf(stderr, "Error opening RDPMC context for event \"%s\"\n",
+                event);
+        continue;
+      }
+    }
+
+    ++pmus->active;
+  }
+
+  /* If PMUs are deactivated activate them now. McKernel only initializes
+   * them on boot. If, for example rawmsr turns them off, they stay off. */
+  if (pmus->mckernel && pmus->global_ctrl == 0) {
+    wrmsr(IA32_PERF_GLOBAL_CTRL, (1ULL << pmus->active) - 1, 1, -1);
+  }
+
+  return (struct pmu *)pmus;
+}
+
+static void jevents_free(struct pmu *pmu) {
+  struct jevents_pmu *pmus = (struct jevents_pmu *)pmu;
+
+  if (pmus->mckernel) {
+    wrmsr(IA32_PERF_GLOBAL_CTRL, pmus->global_ctrl, 1, -1);
+  } else {
+    for (unsigned i = 0; i < pmus->active; ++i) {
+      rdpmc_close(&pmus->ctx[i]);
+    }
+  }
+
+  free(pmus->ctx);
+  free(pmus);
+}
+
+static void jevents_begin(struct pmu *pmu, uint64_t *data) {
+  struct jevents_pmu *pmus = (struct jevents_pmu *)pmu;
+
+  for (unsigned i = 0; i < pmus->active; ++i) {
+    if (pmus->mckernel) {
+      mck_pmc_reset((int)i);
+    } else {
+      data[i] = rdpmc_read(&pmus->ctx[i]);
+    }
+  }
+}
+
+static void jevents_end(struct pmu *pmu, uint64_t *data) {
+  struct jevents_pmu *pmus = (struct jevents_pmu *)pmu;
+
+  for (unsigned i = 0; i < pmus->active; ++i) {
+    if (pmus->mckernel) {
+      data[i] = arch_rdpmc(i);
+    } else {
+      data[i] = rdpmc_read(&pmus->ctx[i]) - data[i];
+    }
+  }
+}
+
+const pmu_backend_t jevents_pmu = {"jevents", jevents_init, jevents_free,
+                                   jevents_begin, jevents_end};
+
+#endif /* JEVENTS_FOUND */
+
+/*
+ * Raw MSR access: the general-purpose counters are programmed and read
+ * through /dev/cpu/N/msr (or McKernel's MSR system calls). Needs raw event
+ * codes; this bypasses and disturbs the kernel's PMU management.
+ */
+
+struct rawmsr_pmu {
+  unsigned active;
+  int mckernel;
+  int msr_fd;
+  uint64_t global_ctrl;
+};
+
+static void rawmsr_info(struct rawmsr_pmu *pmus) {
+  uint32_t eax, ebx, ecx, edx;
+
+  cpuid(0x1, &eax, &ebx, &ecx, &edx);
+
+  if (ecx & (1 << 15)) {
+    const uint64_t caps =
+        rdmsr(IA32_PERF_CAPABILITIES, pmus->mckernel, pmus->msr_fd);
+    const int vmm_freeze = MASK(caps, 12, 12);
+    fprintf(stderr, "Caps: %08llx\n", (unsigned long long)caps);
+    fprintf(stderr, "VMM Freeze: %u\n", vmm_freeze);
+    if (vmm_freeze) {
+      const uint64_t debugctl =
+          rdmsr(IA32_DEBUGCTL, pmus->mckernel, pmus->msr_fd);
+      wrmsr(IA32_DEBUGCTL, debugctl & ~(1ULL << 14), pmus->mckernel,
+            pmus->msr_fd);
+    }
+  }
+
+  cpuid(0xa, &eax, &ebx, &ecx, &edx);
+
+  const unsigned version = MASK(eax, 7, 0);
+  const unsigned counters = MASK(eax, 15, 8);
+  const unsigned width = MASK(eax, 23, 16);
+
+  const unsigned ffpc = MASK(edx, 4, 0);
+  const unsigned ff_width = MASK(edx, 12, 5);
+
+  fprintf(stderr, "PMC version %u\n", version);
+  fprintf(stderr, "PMC counters: %u\n", counters);
+  fprintf(stderr, "PMC width: %u\n", width);
+  fprintf(stderr, "FFPCs: %u, width: %u\n", ffpc, ff_width);
+}
+
+static struct pmu *rawmsr_init(const char **pmcs, const unsigned num_pmcs,
+                               const unsigned cpu, const pmu_config_t *config) {
+  struct rawmsr_pmu *pmus =
+      (struct rawmsr_pmu *)malloc(sizeof(struct rawmsr_pmu));
+  if (pmus == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+  pmus->active = 0;
+  pmus->mckernel = mck_is_mckernel();
+  pmus->msr_fd = -1;
+
+  if (!pmus->mckernel) {
+    char msr[32];
+    snprintf(msr, sizeof(msr), "/dev/cpu/%u/msr", cpu);
+    pmus->msr_fd = open(msr, O_RDWR);
+    if (pmus->msr_fd < 0) {
+      fprintf(stderr, "Opening MSR failed: %d %s\n", errno, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  rawmsr_info(pmus);
+
+  pmus->global_ctrl =
+      rdmsr(IA32_PERF_GLOBAL_CTRL, pmus->mckernel, pmus->msr_fd);
+
+  for (unsigned i = 0; i < num_pmcs; ++i) {
+    struct perf_event_attr attr;
+    const char *event = pmcs[i];
+    if (perf_event_parse(event, &attr) || attr.type != PERF_TYPE_RAW) {
+      fprintf(stderr, "Error resolving event to a raw code: \"%s\".\n",
+              event);
+      continue;
+    }
+
+    /* USR | EN */
+    const uint64_t v = (1 << 22) | (1 << 16) | attr.config;
+    wrmsr(IA32_PERFEVTSEL_BASE + pmus->active, v, pmus->mckernel,
+          pmus->msr_fd);
+    ++pmus->active;
+  }
+
+  wrmsr(IA32_PERF_GLOBAL_CTRL, 0, pmus->mckernel, pmus->msr_fd);
+
+  return (struct pmu *)pmus;
+}
+
+static void rawmsr_free(struct pmu *pmu) {
+  struct rawmsr_pmu *pmus = (struct rawmsr_pmu *)pmu;
+
+  for (unsigned i = 0; i < pmus->active; ++i) {
+    wrmsr(IA32_PERFEVTSEL_BASE + i, 0, pmus->mckernel, pmus->msr_fd);
+  }
+  wrmsr(IA32_PERF_GLOBAL_CTRL, pmus->global_ctrl, pmus->mckernel,
+        pmus->msr_fd);
+
+  if (pmus->msr_fd >= 0) {
+    close(pmus->msr_fd);
+  }
+  free(pmus);
+}
+
+static void rawmsr_begin(struct pmu *pmu, uint64_t *data) {
+  struct rawmsr_pmu *pmus = (struct rawmsr_pmu *)pmu;
+
+  for (unsigned i = 0; i < pmus->active; ++i) {
+    wrmsr(IA32_PMC_BASE + i, 0, pmus->mckernel, pmus->msr_fd);
+  }
+
+  const uint64_t mask = (1ULL << pmus->active) - 1;
+  wrmsr(IA32_PERF_GLOBAL_OVF_CTRL, 0, pmus->mckernel, pmus->msr_fd);
+  wrmsr(IA32_PERF_GLOBAL_CTRL, mask, pmus->mckernel, pmus->msr_fd);
+}
+
+static void rawmsr_end(struct pmu *pmu, uint64_t *data) {
+  struct rawmsr_pmu *pmus = (struct rawmsr_pmu *)pmu;
+
+  wrmsr(IA32_PERF_GLOBAL_CTRL, 0, pmus->mckernel, pmus->msr_fd);
+  const uint64_t ovf =
+      rdmsr(IA32_PERF_GLOBAL_STATUS, pmus->mckernel, pmus->msr_fd);
+  if (ovf) {
+    fprintf(stderr, "OVF: %08llx\n", (unsigned long long)ovf);
+    wrmsr(IA32_PERF_GLOBAL_OVF_CTRL, 0, pmus->mckernel, pmus->msr_fd);
+  }
+
+  for (unsigned i = 0; i < pmus->active; ++i) {
+    data[i] = rdmsr(IA32_PMC_BASE + i, pmus->mckernel, pmus->msr_fd);
+  }
+}
+
+const pmu_backend_t rawmsr_pmu = {"rawmsr", rawmsr_init, rawmsr_free,
+                                  rawmsr_begin, rawmsr_end};
+
+#endif /* __x86_64__ && __linux__ */
@@ -0,0 +1,309 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <resfile.h>
+
+static const char header_magic[8] = "HWPVRES";
+static const char block_magic[8] = "HWPVBLK";
+
+/* Everything in the file starts at a multiple of 8 bytes. */
+static size_t padded(const size_t size) { return (size + 7) & ~(size_t)7; }
+
+static void write_bytes(FILE *file, const void *data, const size_t size) {
+  static const char zeros[8] = {0};
+  if (fwrite(data, 1, size, file) != size ||
+      fwrite(zeros, 1, padded(size) - size, file) != padded(size) - size) {
+    fprintf(stderr, "Error writing result file: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void write_u32x2(FILE *file, const uint32_t a, const uint32_t b) {
+  const uint32_t pair[2] = {a, b};
+  write_bytes(file, pair, sizeof(pair));
+}
+
+/* Length including the terminating NUL, then the string. */
+static void write_string(FILE *file, const char *str) {
+  if (str == NULL) {
+    str = "";
+  }
+  const uint64_t length = strlen(str) + 1;
+  write_bytes(file, &length, sizeof(length));
+  write_bytes(file, str, length);
+}
+
+void resfile_write_header(FILE *file, const double timer_frequency,
+                          const double tsc_frequency, const char *timer,
+                          const char *cpuset, const char **pmcs,
+                          const unsigned num_pmcs, const char *topology) {
+  write_bytes(file, header_magic, sizeof(header_magic));
+  write_u32x2(file, RESFILE_VERSION, num_pmcs);
+  write_bytes(file, &timer_frequency, sizeof(timer_frequency));
+  write_bytes(file, &tsc_frequency, sizeof(tsc_frequency));
+  write_string(file, timer);
+  write_string(file, cpuset);
+  for (unsigned i = 0; i < num_pmcs; ++i) {
+    write_string(file, pmcs[i]);
+  }
+  write_string(file, topology);
+  fflush(file);
+}
+
+/* Append v as LEB128 varint; buffer needs room for 10 bytes. */
+static size_t put_varint(uint8_t *buffer, uint64_t v) {
+  size_t n = 0;
+  while (v >= 0x80) {
+    buffer[n++] = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  buffer[n++] = (uint8_t)v;
+  return n;
+}
+
+/* Encode a column of count values, each stride apart, at buffer. */
+static size_t put_column(uint8_t *buffer, const uint64_t *values,
+                         const unsigned count, const size_t stride) {
+  size_t n = 0;
+  uint64_t previous = 0;
+  for (unsigned i = 0; i < count; ++i) {
+    const uint64_t value = values[i * stride];
+    /* Wraps around for decreasing values; the zigzag makes them small. */
+    const uint64_t delta = value - previous;
+    const uint64_t zigzag = (delta << 1) ^ (uint64_t)((int64_t)delta >> 63);
+    n += put_varint(&buffer[n], zigzag);
+    previous = value;
+  }
+  return n;
+}
+
+void resfile_write_block(FILE *file, const char *name, const unsigned threads,
+                         const unsigned repetitions, const unsigned counters,
+                         const int *cpus, const unsigned *completed,
+                         const uint64_t *data, const uint64_t *starts) {
+  const unsigned per_thread = counters + (starts ? 1 : 0);
+  const size_t columns = (size_t)threads * per_thread;
+
+  uint64_t *offsets = (uint64_t *)malloc(sizeof(uint64_t) * (columns + 1));
+  /* Worst case of 10 bytes per value. */
+  uint8_t *buffer = (uint8_t *)malloc(columns * repetitions * 10 + 1);
+  int32_t *cpu_ids = (int32_t *)malloc(sizeof(int32_t) * threads);
+  if (offsets == NULL || buffer == NULL || cpu_ids == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  size_t size = 0;
+  for (unsigned thread = 0; thread < threads; ++thread) {
+    const uint64_t *samples = &data[(size_t)thread * repetitions * counters];
+    const unsigned reps = completed ? completed[thread] : repetitions;
+    for (unsigned counter = 0; counter < counters; ++counter) {
+      offsets[thread * per_thread + counter] = size;
+      size += put_column(&buffer[size], &samples[counter], reps, counters);
+    }
+    if (starts) {
+      offsets[thread * per_thread + counters] = size;
+      size += put_column(&buffer[size], &starts[(size_t)thread * repetitions],
+                         reps, 1);
+    }
+    cpu_ids[thread] = cpus[thread];
+  }
+  offsets[columns] = size;
+
+  write_bytes(file, block_magic, sizeof(block_magic));
+  write_u32x2(file, threads, repetitions);
+  write_u32x2(file, counters, starts ? 1 : 0);
+  write_string(file, name);
+  write_bytes(file, cpu_ids, sizeof(int32_t) * threads);
+  write_bytes(file, offsets, sizeof(uint64_t) * (columns + 1));
+  write_bytes(file, buffer, size);
+  fflush(file);
+
+  free(cpu_ids);
+  free(buffer);
+  free(offsets);
+}
+
+/* Bounds-checked cursor over the mapping. */
+struct reader {
+  const uint8_t *map;
+  size_t size;
+  size_t pos;
+  int error;
+};
+
+static const void *take(struct reader *r, const size_t size) {
+  const size_t length = padded(size);
+  if (r->error || length < size || length > r->size ||
+      r->pos > r->size - length) {
+    r->error = 1;
+    return NULL;
+  }
+  const void *p = &r->map[r->pos];
+  r->pos += length;
+  return p;
+}
+
+static uint32_t take_u32(struct reader *r, const uint32_t *pair,
+                         const unsigned i) {
+  return (r->error || pair == NULL) ? 0 : pair[i];
+}
+
+static const char *take_string(struct reader *r) {
+  const uint64_t *length = (const uint64_t *)take(r, sizeof(uint64_t));
+  if (length == NULL || *length == 0) {
+    r->error = 1;
+    return NULL;
+  }
+  const char *str = (const char *)take(r, (size_t)*length);
+  if (str == NULL || str[*length - 1] != '\0') {
+    r->error = 1;
+    return NULL;
+  }
+  return str;
+}
+
+int resfile_open(resfile_t *file, const char *path) {
+  memset(file, 0, sizeof(*file));
+
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size == 0) {
+    fprintf(stderr, "Could not read %s\n", path);
+    close(fd);
+    return -1;
+  }
+  void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "Could not map %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  file->map = (const uint8_t *)map;
+  file->size = (size_t)st.st_size;
+
+  struct reader r = {file->map, file->size, 0, 0};
+  const char *magic = (const char *)take(&r, sizeof(header_magic));
+  if (magic == NULL || memcmp(magic, header_magic, sizeof(header_magic))) {
+    fprintf(stderr, "%s is not a result file\n", path);
+    resfile_close(file);
+    return -1;
+  }
+  const uint32_t *version = (const uint32_t *)take(&r, 2 * sizeof(uint32_t));
+  if (take_u32(&r, version, 0) != RESFILE_VERSION) {
+    fprintf(stderr, "%s: unsupported version %u\n", path,
+            take_u32(&r, version, 0));
+    resfile_close(file);
+    return -1;
+  }
+  file->num_pmcs = take_u32(&r, version, 1);
+  if (file->num_pmcs > file->size / 16) {
+    r.error = 1;
+  }
+  const double *frequency = (const double *)take(&r, sizeof(double));
+  file->timer_frequency = frequency ? *frequency : 0.0;
+  frequency = (const double *)take(&r, sizeof(double));
+  file->tsc_frequency = frequency ? *frequency : 0.0;
+  file->timer = take_string(&r);
+  file->cpuset = take_string(&r);
+  file->pmcs = (const char **)malloc(sizeof(char *) * (file->num_pmcs + 1));
+  if (file->pmcs == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+  for (unsigned i = 0; i < file->num_pmcs && !r.error; ++i) {
+    file->pmcs[i] = take_string(&r);
+  }
+  file->topology = take_string(&r);
+
+  if (r.error) {
+    fprintf(stderr, "%s: truncated header\n", path);
+    resfile_close(file);
+    return -1;
+  }
+  file->blocks = r.pos;
+  return 0;
+}
+
+void resfile_close(resfile_t *file) {
+  if (file->map) {
+    munmap((void *)file->map, file->size);
+  }
+  free(file->pmcs);
+  memset(file, 0, sizeof(*file));
+}
+
+int resfile_next_block(const resfile_t *file, size_t *cursor,
+                       resfile_block_t *block) {
+  struct reader r = {file->map, file->size, *cursor ? *cursor : file->blocks,
+                     0};
+  if (r.pos == file->size) {
+    return 0;
+  }
+
+  const char *magic = (const char *)take(&r, sizeof(block_magic));
+  if (magic == NULL || memcmp(magic, block_magic, sizeof(block_magic))) {
+    return -1;
+  }
+  const uint32_t *pair = (const uint32_t *)take(&r, 2 * sizeof(uint32_t));
+  block->threads = take_u32(&r, pair, 0);
+  block->repetitions = take_u32(&r, pair, 1);
+  pair = (const uint32_t *)take(&r, 2 * sizeof(uint32_t));
+  block->counters = take_u32(&r, pair, 0);
+  block->has_starts = (int)take_u32(&r, pair, 1);
+  block->name = take_string(&r);
+  block->cpus =
+      (const int32_t *)take(&r, sizeof(int32_t) * block->threads);
+
+  const size_t columns = (size_t)block->threads *
+                         (block->counters + (block->has_starts ? 1 : 0));
+  block->offsets =
+      (const uint64_t *)take(&r, sizeof(uint64_t) * (columns + 1));
+  if (r.error) {
+    return -1;
+  }
+  for (size_t i = 0; i < columns; ++i) {
+    if (block->offsets[i] > block->offsets[i + 1]) {
+      return -1;
+    }
+  }
+  block->data = (const uint8_t *)take(&r, (size_t)block->offsets[columns]);
+  if (r.error) {
+    return -1;
+  }
+
+  *cursor = r.pos;
+  return 1;
+}
+
+int resfile_column(const resfile_block_t *block, const unsigned thread,
+                   const unsigned column, resfile_column_t *it) {
+  const unsigned per_thread = block->counters + (block->has_starts ? 1 : 0);
+  unsigned index = column;
+  if (column == RESFILE_STARTS) {
+    if (!block->has_starts) {
+      return -1;
+    }
+    index = block->counters;
+  }
+  if (thread >= block->threads || index >= per_thread) {
+    return -1;
+  }
+
+  const size_t i = (size_t)thread * per_thread + index;
+  it->pos = &block->data[block->offsets[i]];
+  it->end = &block->data[block->offsets[i + 1]];
+  it->value = 0;
+  it->remaining = block->repetitions;
+  return 0;
+}
@@ -0,0 +1,276 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <config.h>
+
+#ifdef __linux__
+#include <dlfcn.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include <pmu.h>
+#include <sample.h>
+
+/* Data pages of the ring buffer; a power of two. */
+#ifndef SAMPLE_BUFFER_PAGES
+#define SAMPLE_BUFFER_PAGES 64
+#endif
+
+static int compare_ip(const void *a_, const void *b_) {
+  const sample_ip_t *a = (const sample_ip_t *)a_;
+  const sample_ip_t *b = (const sample_ip_t *)b_;
+  return (a->ip > b->ip) - (a->ip < b->ip);
+}
+
+static int compare_count(const void *a_, const void *b_) {
+  const sample_ip_t *a = (const sample_ip_t *)a_;
+  const sample_ip_t *b = (const sample_ip_t *)b_;
+  return (a->count < b->count) - (a->count > b->count);
+}
+
+/* Sort ips by address and fold duplicates. */
+static unsigned compact(sample_ip_t *ips, const unsigned num_ips) {
+  if (num_ips == 0) {
+    return 0;
+  }
+  qsort(ips, num_ips, sizeof(sample_ip_t), compare_ip);
+  unsigned n = 0;
+  for (unsigned i = 1; i < num_ips; ++i) {
+    if (ips[i].ip == ips[n].ip) {
+      ips[n].count += ips[i].count;
+    } else {
+      ips[++n] = ips[i];
+    }
+  }
+  return n + 1;
+}
+
+void sample_hist_free(sample_hist_t *hist) {
+  free(hist->ips);
+  hist->ips = NULL;
+  hist->num_ips = 0;
+}
+
+void sample_hist_merge(sample_hist_t *dst, const sample_hist_t *src) {
+  const unsigned num_ips = dst->num_ips + src->num_ips;
+  if (num_ips == 0) {
+    dst->samples += src->samples;
+    dst->lost += src->lost;
+    return;
+  }
+  sample_ip_t *ips =
+      (sample_ip_t *)realloc(dst->ips, sizeof(sample_ip_t) * num_ips);
+  if (ips == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(&ips[dst->num_ips], src->ips, sizeof(sample_ip_t) * src->num_ips);
+  dst->ips = ips;
+  dst->num_ips = compact(ips, num_ips);
+  dst->samples += src->samples;
+  dst->lost += src->lost;
+}
+
+void sample_hist_print(FILE *file, const sample_hist_t *hist,
+                       const unsigned top) {
+  fprintf(file, "%8" PRIu64 " %6" PRIu64, hist->samples, hist->lost);
+  if (hist->num_ips == 0) {
+    fprintf(file, "\n");
+    return;
+  }
+
+  sample_ip_t *ips = (sample_ip_t *)malloc(sizeof(sample_ip_t) * hist->num_ips);
+  if (ips == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(ips, hist->ips, sizeof(sample_ip_t) * hist->num_ips);
+  qsort(ips, hist->num_ips, sizeof(sample_ip_t), compare_count);
+
+  for (unsigned i = 0; i < top && i < hist->num_ips; ++i) {
+    fprintf(file, "  0x%" PRIx64, ips[i].ip);
+#ifdef __linux__
+    /* Symbols of the executable need it to be linked with -rdynamic; for
+     * static functions, the offset into the object works with addr2line. */
+    Dl_info info;
+    if (!dladdr((void *)(uintptr_t)ips[i].ip, &info)) {
+      fprintf(file, " ?");
+    } else if (info.dli_sname) {
+      fprintf(file, " %s+0x%" PRIxPTR, info.dli_sname,
+              (uintptr_t)ips[i].ip - (uintptr_t)info.dli_saddr);
+    } else {
+      const char *object = strrchr(info.dli_fname, '/');
+      fprintf(file, " %s+0x%" PRIxPTR, object ? object + 1 : info.dli_fname,
+              (uintptr_t)ips[i].ip - (uintptr_t)info.dli_fbase);
+    }
+#endif
+    fprintf(file, " %" PRIu64, ips[i].count);
+  }
+  fprintf(file, "\n");
+  free(ips);
+}
+
+#ifdef __linux__
+
+struct sampler {
+  int fd;
+  struct perf_event_mmap_page *page; /* followed by the data pages */
+  unsigned char *data;
+  uint64_t size; /* of the data area */
+  sample_ip_t *ips; /* scratch space for draining */
+  unsigned capacity;
+};
+
+static long page_size(void) { return sysconf(_SC_PAGESIZE); }
+
+static int open_sampling(struct perf_event_attr *attr,
+                         const uint64_t period) {
+  attr->sample_period = period;
+  attr->sample_type = PERF_SAMPLE_IP;
+  attr->disabled = 1;
+  attr->exclude_kernel = 1;
+  attr->exclude_hv = 1;
+  /* The buffer is drained after each repetition, never polled. */
+  attr->wakeup_events = 0;
+  return (int)syscall(__NR_perf_event_open, attr, 0, -1, -1, 0);
+}
+
+struct sampler *sampler_open(const sample_config_t *config,
+                             const unsigned cpu) {
+  const char *event = config->event ? config->event : "cycles";
+  struct perf_event_attr attr;
+  if (perf_event_parse(event, &attr)) {
+    fprintf(stderr, "Error resolving event: \"%s\".\n", event);
+    exit(EXIT_FAILURE);
+  }
+
+  int fd = open_sampling(&attr, config->period);
+  if (fd < 0 && config->event == NULL) {
+    /* No hardware PMU, e.g. in a VM: sample the software clock in ns. */
+    perf_event_parse("cpu-clock", &attr);
+    fd = open_sampling(&attr, config->period);
+    static int warned = 0;
+    if (fd >= 0 && !__atomic_exchange_n(&warned, 1, __ATOMIC_RELAXED)) {
+      fprintf(stderr, "[Sample] cycles not available, sampling cpu-clock\n");
+    }
+  }
+  if (fd < 0) {
+    fprintf(stderr, "perf_event_open() for sampling \"%s\" failed: %s\n",
+            event, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  struct sampler *sampler = (struct sampler *)malloc(sizeof(struct sampler));
+  if (sampler == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+  sampler->fd = fd;
+  sampler->size = (uint64_t)SAMPLE_BUFFER_PAGES * (uint64_t)page_size();
+  void *mem = mmap(NULL, (size_t)(sampler->size + (uint64_t)page_size()),
+                   PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mem == MAP_FAILED) {
+    fprintf(stderr, "mmap() of the sample buffer failed: %s\n",
+            strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  sampler->page = (struct perf_event_mmap_page *)mem;
+  sampler->data = (unsigned char *)mem + page_size();
+  sampler->capacity = 1024;
+  sampler->ips = (sample_ip_t *)malloc(sizeof(sample_ip_t) * sampler->capacity);
+  if (sampler->ips == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  return sampler;
+}
+
+void sampler_close(struct sampler *sampler) {
+  munmap(sampler->page, (size_t)(sampler->size + (uint64_t)page_size()));
+  close(sampler->fd);
+  free(sampler->ips);
+  free(sampler);
+}
+
+void sampler_begin(struct sampler *sampler) {
+  ioctl(sampler->fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+void sampler_end(struct sampler *sampler) {
+  ioctl(sampler->fd, PERF_EVENT_IOC_DISABLE, 0);
+}
+
+/* Copy len bytes at offset of the ring buffer, which may wrap around. */
+static void ring_copy(const struct sampler *sampler, uint64_t offset,
+                      void *dst, const size_t len) {
+  offset &= sampler->size - 1;
+  const size_t first =
+      (len < sampler->size - offset) ? len : (size_t)(sampler->size - offset);
+  memcpy(dst, &sampler->data[offset], first);
+  memcpy((unsigned char *)dst + first, sampler->data, len - first);
+}
+
+void sampler_drain(struct sampler *sampler, sample_hist_t *hist) {
+  struct perf_event_mmap_page *page = sampler->page;
+  const uint64_t head = __atomic_load_n(&page->data_head, __ATOMIC_ACQUIRE);
+  uint64_t tail = page->data_tail;
+  unsigned num_ips = 0;
+
+  while (tail < head) {
+    struct perf_event_header header;
+    ring_copy(sampler, tail, &header, sizeof(header));
+    if (header.size < sizeof(header)) {
+      break;
+    }
+
+    if (header.type == PERF_RECORD_SAMPLE) {
+      uint64_t ip;
+      ring_copy(sampler, tail + sizeof(header), &ip, sizeof(ip));
+      if (num_ips == sampler->capacity) {
+        sampler->capacity *= 2;
+        sampler->ips = (sample_ip_t *)realloc(
+            sampler->ips, sizeof(sample_ip_t) * sampler->capacity);
+        if (sampler->ips == NULL) {
+          fprintf(stderr, "Error allocating memory\n");
+          exit(EXIT_FAILURE);
+        }
+      }
+      sampler->ips[num_ips].ip = ip;
+      sampler->ips[num_ips].count = 1;
+      ++num_ips;
+      ++hist->samples;
+    } else if (header.type == PERF_RECORD_LOST) {
+      uint64_t lost[2]; /* id, lost */
+      ring_copy(sampler, tail + sizeof(header), lost, sizeof(lost));
+      hist->lost += lost[1];
+    }
+
+    tail += header.size;
+  }
+  __atomic_store_n(&page->data_tail, tail, __ATOMIC_RELEASE);
+
+  sample_hist_t drained = {sampler->ips, compact(sampler->ips, num_ips), 0, 0};
+  sample_hist_merge(hist, &drained);
+}
+
+#else
+
+struct sampler *sampler_open(const sample_config_t *config,
+                             const unsigned cpu) {
+  fprintf(stderr, "Sampling is only available on Linux.\n");
+  exit(EXIT_FAILURE);
+}
+void sampler_close(struct sampler *sampler) {}
+void sampler_begin(struct sampler *sampler) {}
+void sampler_end(struct sampler *sampler) {}
+void sampler_drain(struct sampler *sampler, sample_hist_t *hist) {}
+
+#endif /* __linux__ */
@@ -0,0 +1,170 @@
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <config.h>
+
+#include <arch.h>
+#include <sink.h>
+
+/* Records per ring; bounds the memory to threads * this * record size. */
+#ifndef SINK_RING_RECORDS
+#define SINK_RING_RECORDS 256
+#endif
+
+/* Header fields of a record before the sample. */
+#define SINK_HEADER 2
+
+void sink_push(sink_ring_t *ring, const unsigned rep, const uint64_t start,
+               const uint64_t *sample) {
+  const uint64_t head = ring->head;
+  if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) ==
+      ring->capacity) {
+    ++ring->waits;
+    while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) ==
+           ring->capacity) {
+      arch_relax();
+    }
+  }
+
+  uint64_t *record = &ring->records[(head % ring->capacity) * ring->width];
+  record[0] = rep;
+  record[1] = start;
+  memcpy(&record[SINK_HEADER], sample,
+         sizeof(uint64_t) * (ring->width - SINK_HEADER));
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Write out all records in ring; returns how many. */
+static uint64_t drain(sink_t *sink, sink_ring_t *ring) {
+  const uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  uint64_t tail = ring->tail;
+  const uint64_t drained = head - tail;
+
+  for (; tail < head; ++tail) {
+    const uint64_t *record =
+        &ring->records[(tail % ring->capacity) * ring->width];
+    uint64_t duration = record[SINK_HEADER];
+    if (sink->ns_per_tick != 0.0) {
+      duration = (uint64_t)llround((double)duration * sink->ns_per_tick);
+    }
+    fprintf(sink->file, "%2d %6" PRIu64 " %20" PRIu64 " %10" PRIu64, ring->cpu,
+            record[0], record[1], duration);
+    for (unsigned i = SINK_HEADER + 1; i < ring->width; ++i) {
+      fprintf(sink->file, " %10" PRIu64, record[i]);
+    }
+    fprintf(sink->file, "\n");
+    /* Hand the slot back only once it is written out. */
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+  }
+
+  return drained;
+}
+
+static void *writer(void *arg_) {
+  sink_t *sink = (sink_t *)arg_;
+
+  if (sink->writer_cpuset &&
+      hwloc_set_cpubind(sink->topology, sink->writer_cpuset,
+                        HWLOC_CPUBIND_THREAD)) {
+    perror("hwloc_set_cpubind() for the sink writer failed");
+  }
+
+  while (1) {
+    /* Read before draining, so that nothing pushed before close is lost. */
+    const int closing = __atomic_load_n(&sink->closing, __ATOMIC_ACQUIRE);
+    uint64_t drained = 0;
+    for (unsigned i = 0; i < sink->threads; ++i) {
+      drained += drain(sink, &sink->rings[i]);
+    }
+    if (drained) {
+      fflush(sink->file);
+    } else if (closing) {
+      break;
+    } else {
+      const struct timespec nap = {0, 1000 * 1000}; /* 1ms */
+      nanosleep(&nap, NULL);
+    }
+  }
+
+  return NULL;
+}
+
+sink_t *sink_open(FILE *file, const unsigned threads, const int *cpus,
+                  const unsigned num_counters, const double ns_per_tick,
+                  hwloc_topology_t topology, hwloc_const_cpuset_t runset) {
+  sink_t *sink = (sink_t *)malloc(sizeof(sink_t));
+  if (sink == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+  sink->file = file;
+  sink->threads = threads;
+  sink->ns_per_tick = ns_per_tick;
+  sink->closing = 0;
+  sink->topology = topology;
+  sink->writer_cpuset = NULL;
+
+  if (posix_memalign((void **)&sink->rings, 64,
+                     sizeof(sink_ring_t) * threads)) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+  for (unsigned i = 0; i < threads; ++i) {
+    sink_ring_t *ring = &sink->rings[i];
+    ring->head = 0;
+    ring->tail = 0;
+    ring->capacity = SINK_RING_RECORDS;
+    ring->width = SINK_HEADER + num_counters;
+    ring->waits = 0;
+    ring->cpu = cpus[i];
+    ring->records = (uint64_t *)malloc(sizeof(uint64_t) * ring->capacity *
+                                       ring->width);
+    if (ring->records == NULL) {
+      fprintf(stderr, "Error allocating memory\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  /* Keep the writer off the measured CPUs if possible. */
+  if (hwloc_topology_is_thissystem(topology)) {
+    hwloc_cpuset_t idle =
+        hwloc_bitmap_dup(hwloc_topology_get_topology_cpuset(topology));
+    hwloc_bitmap_andnot(idle, idle, runset);
+    if (hwloc_bitmap_iszero(idle)) {
+      fprintf(stderr, "[Sink] no idle CPU, the writer shares measured CPUs\n");
+      hwloc_bitmap_free(idle);
+    } else {
+      sink->writer_cpuset = idle;
+    }
+  }
+
+  if (pthread_create(&sink->writer, NULL, writer, sink)) {
+    fprintf(stderr, "Error creating thread.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  return sink;
+}
+
+void sink_close(sink_t *sink) {
+  __atomic_store_n(&sink->closing, 1, __ATOMIC_RELEASE);
+  pthread_join(sink->writer, NULL);
+
+  for (unsigned i = 0; i < sink->threads; ++i) {
+    sink_ring_t *ring = &sink->rings[i];
+    if (ring->waits) {
+      fprintf(stderr, "[Sink] CPU %2d waited %" PRIu64
+              " times for the writer\n", ring->cpu, ring->waits);
+    }
+    free(ring->records);
+  }
+  free(sink->rings);
+  if (sink->writer_cpuset) {
+    hwloc_bitmap_free(sink->writer_cpuset);
+  }
+  free(sink);
+}
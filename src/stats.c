@@ -0,0 +1,193 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <stats.h>
+
+static unsigned bucket_index(const uint64_t value) {
+  if (value < 2 * STATS_SUB_BUCKETS) {
+    return (unsigned)value;
+  }
+  const unsigned msb = 63U - (unsigned)__builtin_clzll(value);
+  const unsigned shift = msb - STATS_SUB_BUCKET_BITS;
+  return shift * STATS_SUB_BUCKETS + (unsigned)(value >> shift);
+}
+
+/* The middle of the values falling into bucket index. */
+static uint64_t bucket_value(const unsigned index) {
+  if (index < 2 * STATS_SUB_BUCKETS) {
+    return index;
+  }
+  const unsigned shift = index / STATS_SUB_BUCKETS - 1;
+  const uint64_t top = index - shift * STATS_SUB_BUCKETS;
+  return (top << shift) + ((1ULL << shift) >> 1);
+}
+
+void stats_init(online_stats_t *stats) {
+  stats->count = 0;
+  stats->mean = 0.0;
+  stats->m2 = 0.0;
+  stats->min = UINT64_MAX;
+  stats->max = 0;
+  stats->buckets = (uint64_t *)calloc(STATS_BUCKETS, sizeof(uint64_t));
+  if (stats->buckets == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+void stats_free(online_stats_t *stats) {
+  free(stats->buckets);
+  stats->buckets = NULL;
+}
+
+void stats_add(online_stats_t *stats, const uint64_t value) {
+  ++stats->count;
+  const double delta = (double)value - stats->mean;
+  stats->mean += delta / (double)stats->count;
+  stats->m2 += delta * ((double)value - stats->mean);
+  stats->min = (value < stats->min) ? value : stats->min;
+  stats->max = (value > stats->max) ? value : stats->max;
+  ++stats->buckets[bucket_index(value)];
+}
+
+void stats_merge(online_stats_t *dst, const online_stats_t *src) {
+  if (src->count == 0) {
+    return;
+  }
+  /* Chan et al.'s pairwise update of mean and m2. */
+  const double n_a = (double)dst->count;
+  const double n_b = (double)src->count;
+  const double n = n_a + n_b;
+  const double delta = src->mean - dst->mean;
+  dst->mean += delta * n_b / n;
+  dst->m2 += src->m2 + delta * delta * n_a * n_b / n;
+  dst->count += src->count;
+  dst->min = (src->min < dst->min) ? src->min : dst->min;
+  dst->max = (src->max > dst->max) ? src->max : dst->max;
+  for (unsigned i = 0; i < STATS_BUCKETS; ++i) {
+    dst->buckets[i] += src->buckets[i];
+  }
+}
+
+uint64_t stats_quantile(const online_stats_t *stats, const double q) {
+  if (stats->count == 0) {
+    return 0;
+  }
+  uint64_t rank = (uint64_t)ceil(q * (double)stats->count);
+  rank = (rank == 0) ? 1 : rank;
+
+  uint64_t seen = 0;
+  for (unsigned i = 0; i < STATS_BUCKETS; ++i) {
+    seen += stats->buckets[i];
+    if (seen >= rank) {
+      /* The bucket's middle, but never outside the observed range. */
+      uint64_t value = bucket_value(i);
+      value = (value < stats->min) ? stats->min : value;
+      value = (value > stats->max) ? stats->max : value;
+      return value;
+    }
+  }
+  return stats->max;
+}
+
+void stats_summarize(const online_stats_t *stats, stats_summary_t *summary) {
+  summary->count = stats->count;
+  summary->mean = stats->mean;
+  summary->stddev =
+      (stats->count > 1) ? sqrt(stats->m2 / (double)(stats->count - 1)) : 0.0;
+  summary->cv = (stats->mean != 0.0) ? summary->stddev / stats->mean : 0.0;
+  summary->min = stats->count ? stats->min : 0;
+  summary->p50 = stats_quantile(stats, 0.5);
+  summary->p99 = stats_quantile(stats, 0.99);
+  summary->p999 = stats_quantile(stats, 0.999);
+  summary->max = stats->max;
+}
+
+void steady_init(steady_t *steady, const unsigned window, const double cv) {
+  steady->values = (uint64_t *)malloc(sizeof(uint64_t) * window);
+  if (window && steady->values == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+  steady->size = window;
+  steady->count = 0;
+  steady->cv = cv;
+}
+
+void steady_free(steady_t *steady) {
+  free(steady->values);
+  steady->values = NULL;
+}
+
+int steady_add(steady_t *steady, const uint64_t value) {
+  if (steady->size == 0) {
+    return 0;
+  }
+  steady->values[steady->count++ % steady->size] = value;
+  if (steady->count < steady->size) {
+    return 0;
+  }
+
+  /* Two passes over a handful of values; outside the timed region. */
+  double mean = 0.0;
+  for (unsigned i = 0; i < steady->size; ++i) {
+    mean += (double)steady->values[i];
+  }
+  mean /= steady->size;
+  double m2 = 0.0;
+  for (unsigned i = 0; i < steady->size; ++i) {
+    const double delta = (double)steady->values[i] - mean;
+    m2 += delta * delta;
+  }
+  const double stddev =
+      (steady->size > 1) ? sqrt(m2 / (double)(steady->size - 1)) : 0.0;
+  return mean != 0.0 && stddev / mean < steady->cv;
+}
+
+void median_ci_init(median_ci_t *ci, const unsigned capacity) {
+  ci->sorted = (uint64_t *)malloc(sizeof(uint64_t) * capacity);
+  if (capacity && ci->sorted == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+  ci->count = 0;
+  ci->capacity = capacity;
+}
+
+void median_ci_free(median_ci_t *ci) {
+  free(ci->sorted);
+  ci->sorted = NULL;
+}
+
+void median_ci_add(median_ci_t *ci, const uint64_t value) {
+  if (ci->count == ci->capacity) {
+    return;
+  }
+  /* Insertion from the top; outside the timed region. */
+  unsigned i = ci->count++;
+  while (i > 0 && ci->sorted[i - 1] > value) {
+    ci->sorted[i] = ci->sorted[i - 1];
+    --i;
+  }
+  ci->sorted[i] = value;
+}
+
+double median_ci_width(const median_ci_t *ci) {
+  const unsigned n = ci->count;
+  /* Ranks j and k (1-based) of the interval: n / 2 -+ 1.96 sqrt(n) / 2. */
+  const double spread = 1.96 * sqrt((double)n) / 2.0;
+  const long j = lround((double)n / 2.0 - spread);
+  const long k = lround(1.0 + (double)n / 2.0 + spread);
+  if (n == 0 || j < 1 || k > (long)n) {
+    return INFINITY;
+  }
+
+  const double median =
+      ((double)ci->sorted[(n - 1) / 2] + (double)ci->sorted[n / 2]) / 2.0;
+  if (median == 0.0) {
+    return INFINITY;
+  }
+  return (double)(ci->sorted[k - 1] - ci->sorted[j - 1]) / 2.0 / median;
+}
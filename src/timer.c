@@ -0,0 +1,161 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <config.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include <arch.h>
+#include <timer.h>
+#include <tsc.h>
+
+#ifndef TIMER_CALIBRATION_ROUNDS
+#define TIMER_CALIBRATION_ROUNDS 1000
+#endif
+
+const char *timer_name(const enum timer_type type) {
+  switch (type) {
+  case TIMER_ARCH:
+#ifdef __x86_64__
+    return "rdtscp-cpuid";
+#else
+    return "arch";
+#endif
+  case TIMER_LFENCE_RDTSC:
+    return "lfence-rdtsc";
+  case TIMER_RDTSCP:
+    return "rdtscp";
+  case TIMER_CLOCK_GETTIME:
+    return "clock_gettime";
+  case TIMER_PERF_CYCLES:
+    return "perf-cycles";
+  case NR_TIMERS:
+    break;
+  }
+  return "unknown";
+}
+
+#ifdef __linux__
+static int open_cycles(const int exclude_kernel) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_CPU_CYCLES;
+  attr.exclude_kernel = exclude_kernel ? 1 : 0;
+  attr.exclude_hv = 1;
+
+  return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void perf_cycles_init(struct timer *timer) {
+  /* Kernel cycles belong to the duration, if we may count them. */
+  timer->fd = open_cycles(0);
+  if (timer->fd < 0 && (errno == EACCES || errno == EPERM)) {
+    timer->fd = open_cycles(1);
+  }
+  if (timer->fd < 0) {
+    fprintf(stderr, "perf_event_open() for cycles failed: %s\n",
+            strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+#ifdef __x86_64__
+  void *page = mmap(NULL, (size_t)sysconf(_SC_PAGESIZE), PROT_READ,
+                    MAP_SHARED, timer->fd, 0);
+  if (page != MAP_FAILED) {
+    timer->page = (struct perf_event_mmap_page *)page;
+    /* Fall back to read(2) if user space may not use rdpmc. */
+    if (!timer->page->cap_user_rdpmc) {
+      munmap(page, (size_t)sysconf(_SC_PAGESIZE));
+      timer->page = NULL;
+    }
+  }
+#endif
+}
+#endif
+
+void timer_init(struct timer *timer) {
+  timer->fd = -1;
+  timer->page = NULL;
+  timer->overhead = 0;
+
+  switch (timer->type) {
+  case TIMER_ARCH:
+    break;
+  case TIMER_LFENCE_RDTSC:
+  case TIMER_RDTSCP:
+#ifndef __x86_64__
+    fprintf(stderr, "Timer %s is only available on x86_64.\n",
+            timer_name(timer->type));
+    exit(EXIT_FAILURE);
+#endif
+    break;
+  case TIMER_CLOCK_GETTIME:
+#ifndef HAVE_CLOCK_GETTIME
+    fprintf(stderr, "Timer %s is not available.\n", timer_name(timer->type));
+    exit(EXIT_FAILURE);
+#endif
+    break;
+  case TIMER_PERF_CYCLES:
+#ifdef __linux__
+    perf_cycles_init(timer);
+#else
+    fprintf(stderr, "Timer %s is only available on Linux.\n",
+            timer_name(timer->type));
+    exit(EXIT_FAILURE);
+#endif
+    break;
+  case NR_TIMERS:
+    fprintf(stderr, "Invalid timer.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* The smallest empty measurement is the fixed cost of every sample. */
+  uint64_t overhead = UINT64_MAX;
+  for (unsigned i = 0; i < TIMER_CALIBRATION_ROUNDS; ++i) {
+    const uint64_t start = arch_timer_begin(timer);
+    const uint64_t end = arch_timer_end(timer);
+    overhead = (end - start < overhead) ? end - start : overhead;
+  }
+  timer->overhead = overhead;
+}
+
+void timer_free(struct timer *timer) {
+#ifdef __linux__
+  if (timer->page) {
+    munmap(timer->page, (size_t)sysconf(_SC_PAGESIZE));
+    timer->page = NULL;
+  }
+#endif
+  if (timer->fd >= 0) {
+    close(timer->fd);
+    timer->fd = -1;
+  }
+}
+
+double timer_frequency(struct timer *timer) {
+  switch (timer->type) {
+  case TIMER_CLOCK_GETTIME:
+    return 1e9;
+  case TIMER_PERF_CYCLES: {
+    const uint64_t duration = 100 * 1000 * 1000UL; /* 100ms */
+    const uint64_t start = arch_clock_gettime();
+    const uint64_t cycles_start = arch_perf_cycles(timer);
+    uint64_t now;
+    while ((now = arch_clock_gettime()) < start + duration)
+      ;
+    const uint64_t cycles_end = arch_perf_cycles(timer);
+
+    return (double)(cycles_end - cycles_start) * 1e9 / (double)(now - start);
+  }
+  default:
+    /* All other timers read the timestamp counter. */
+    return tsc_frequency();
+  }
+}
@@ -0,0 +1,255 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include <config.h>
+
+#include <arch.h>
+#include <tsc.h>
+#include <worker.h>
+
+#ifndef TSC_CALIBRATION_ROUNDS
+#define TSC_CALIBRATION_ROUNDS 1000
+#endif
+
+/* Large enough for the largest cache line we know of (A64FX). */
+#define TSC_LINE 256
+
+static uint64_t get_time() {
+#ifdef HAVE_CLOCK_GETTIME
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC_RAW, &ts)) {
+    perror("clock_gettime() failed");
+    exit(EXIT_FAILURE);
+  }
+
+  return (uint64_t)ts.tv_sec * 1000 * 1000 * 1000 + (uint64_t)ts.tv_nsec;
+#else
+  struct timeval tv;
+  if (gettimeofday(&tv, NULL)) {
+    perror("gettimeofday() failed");
+    exit(EXIT_FAILURE);
+  }
+
+  return (uint64_t)tv.tv_sec * 1000 * 1000 * 1000 + (uint64_t)tv.tv_usec * 1000;
+#endif
+}
+
+double tsc_frequency(void) {
+  static double frequency = 0.0;
+
+  if (frequency == 0.0) {
+    const uint64_t duration = 100 * 1000 * 1000UL; /* 100ms */
+    const uint64_t start = get_time();
+    const uint64_t ticks_start = arch_timestamp_begin();
+    uint64_t now;
+    while ((now = get_time()) < start + duration)
+      ;
+    const uint64_t ticks_end = arch_timestamp_end();
+
+    frequency = (double)(ticks_end - ticks_start) * 1e9 / (double)(now - start);
+  }
+
+  return frequency;
+}
+
+/* The line both threads bounce between their caches. */
+typedef struct {
+  uint32_t turn;  /* number of the last hop */
+  uint64_t stamp; /* timestamp of the responder */
+} pingpong_line_t;
+
+typedef struct {
+  pingpong_line_t *line;
+  unsigned side;  /* 0: thread a, 1: thread b */
+  int64_t offset; /* of the other side's counter, from the fastest round */
+  uint64_t rtt;   /* latency of the fastest round */
+} pingpong_t;
+
+static void *pingpong(void *arg_) {
+  pingpong_t *arg = (pingpong_t *)arg_;
+  pingpong_line_t *line = arg->line;
+
+  arg->rtt = UINT64_MAX;
+  arg->offset = 0;
+
+  /* Both sides take turns initiating a round. */
+  for (uint32_t round = 0; round < TSC_CALIBRATION_ROUNDS; ++round) {
+    const uint32_t ping = 2 * round + 1;
+    const uint32_t pong = 2 * round + 2;
+
+    if ((round & 1) == arg->side) {
+      const uint64_t t0 = arch_timestamp_begin();
+      __atomic_store_n(&line->turn, ping, __ATOMIC_RELEASE);
+      /* The responder may already have started the next round. */
+      while (__atomic_load_n(&line->turn, __ATOMIC_ACQUIRE) < pong) {
+        arch_relax();
+      }
+      const uint64_t t1 = arch_timestamp_begin();
+
+      const uint64_t rtt = t1 - t0;
+      if (rtt < arg->rtt) {
+        arg->rtt = rtt;
+        arg->offset = (int64_t)(line->stamp - (t0 + rtt / 2));
+      }
+    } else {
+      while (__atomic_load_n(&line->turn, __ATOMIC_ACQUIRE) != ping) {
+        arch_relax();
+      }
+      line->stamp = arch_timestamp_begin();
+      __atomic_store_n(&line->turn, pong, __ATOMIC_RELEASE);
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Ping-pong between the threads a and b.
+ *
+ * @param rtt if not NULL, receives the smallest round trip time
+ * @return the offset of b's counter to a's counter
+ **/
+static int64_t measure_offset(threads_t *workers, const unsigned a,
+                              const unsigned b, uint64_t *rtt) {
+  benchmark_t pingpong_ops = {"pingpong", NULL, NULL, NULL,
+                              NULL,       pingpong, NULL,
+                              0};
+  struct arg *args[2] = {&workers->threads[a].thread_arg,
+                         &workers->threads[b].thread_arg};
+
+  pingpong_line_t *line;
+  if (posix_memalign((void **)&line, TSC_LINE, TSC_LINE)) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+  memset(line, 0, TSC_LINE);
+
+  pingpong_t sides[2];
+  step_t *step = init_step(2, workers->barrier, NULL);
+  for (unsigned side = 0; side < 2; ++side) {
+    sides[side].line = line;
+    sides[side].side = side;
+
+    work_t *work = &step->work[side];
+    work->ops = &pingpong_ops;
+    work->arg = &sides[side];
+    work->barrier = &step->barrier;
+    work->result = NULL;
+    work->reps = 1;
+    work->pmcs = NULL;
+    work->num_pmcs = 0;
+  }
+
+  for (unsigned side = 0; side < 2; ++side) {
+    queue_work(args[side], &step->work[side]);
+  }
+  /* If the dirigent takes part, it has to run its side itself. */
+  assert(workers->threads[0].thread_arg.dirigent);
+  if (a == 0 || b == 0) {
+    worker(&workers->threads[0].thread_arg);
+  }
+  for (unsigned side = 0; side < 2; ++side) {
+    wait_until_done(args[side]);
+  }
+
+  free_step(step);
+  free(line);
+
+  if (rtt) {
+    *rtt = (sides[0].rtt < sides[1].rtt) ? sides[0].rtt : sides[1].rtt;
+  }
+
+  /* Each side saw the other's offset; asymmetric hop latencies cancel. */
+  return (sides[0].offset - sides[1].offset) / 2;
+}
+
+int64_t *tsc_offsets(threads_t *workers) {
+  const int threads = hwloc_bitmap_weight(workers->cpuset);
+  assert(threads > 0);
+
+  int64_t *offsets = (int64_t *)malloc(sizeof(int64_t) * (unsigned)threads);
+  if (offsets == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  offsets[0] = 0;
+  for (unsigned i = 1; i < (unsigned)threads; ++i) {
+    uint64_t rtt;
+    offsets[i] = measure_offset(workers, 0, i, &rtt);
+    fprintf(stderr, "[TSC] CPU %2u: offset %6" PRId64 ", round trip %6" PRIu64
+                    "\n",
+            workers->threads[i].thread_arg.cpu, offsets[i], rtt);
+  }
+
+  return offsets;
+}
+
+void tsc_report(threads_t *workers, const int64_t *offsets) {
+  const int threads_ = hwloc_bitmap_weight(workers->cpuset);
+  assert(threads_ > 0);
+  const unsigned threads = (unsigned)threads_;
+  const double frequency = tsc_frequency();
+
+  /* skew[a * threads + b]: b's counter reads that many ticks ahead of a's. */
+  int64_t *skew = (int64_t *)calloc(threads * threads, sizeof(int64_t));
+  if (skew == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  uint64_t max_rtt = 0;
+  for (unsigned a = 0; a < threads; ++a) {
+    for (unsigned b = a + 1; b < threads; ++b) {
+      uint64_t rtt;
+      skew[a * threads + b] = measure_offset(workers, a, b, &rtt);
+      skew[b * threads + a] = -skew[a * threads + b];
+      max_rtt = (rtt > max_rtt) ? rtt : max_rtt;
+    }
+  }
+
+  fprintf(stderr, "[TSC] skew matrix (ticks the column's clock is ahead of the row's):\n");
+  fprintf(stderr, "[TSC]    ");
+  for (unsigned b = 0; b < threads; ++b) {
+    fprintf(stderr, " %6u", workers->threads[b].thread_arg.cpu);
+  }
+  fprintf(stderr, "\n");
+
+  uint64_t max_skew = 0;
+  uint64_t max_error = 0;
+  for (unsigned a = 0; a < threads; ++a) {
+    fprintf(stderr, "[TSC] %3u", workers->threads[a].thread_arg.cpu);
+    for (unsigned b = 0; b < threads; ++b) {
+      const int64_t s = skew[a * threads + b];
+      fprintf(stderr, " %6" PRId64, s);
+
+      const uint64_t abs_skew = (uint64_t)((s < 0) ? -s : s);
+      max_skew = (abs_skew > max_skew) ? abs_skew : max_skew;
+      /* Correcting via the dirigent has to agree with the direct offset. */
+      if (offsets) {
+        const int64_t e = s - (offsets[b] - offsets[a]);
+        const uint64_t abs_error = (uint64_t)((e < 0) ? -e : e);
+        max_error = (abs_error > max_error) ? abs_error : max_error;
+      }
+    }
+    fprintf(stderr, "\n");
+  }
+
+  fprintf(stderr,
+          "[TSC] max skew: %" PRIu64 " ticks (%.1f ns), max round trip: %" PRIu64
+          " ticks (%.1f ns)\n",
+          max_skew, (double)max_skew * 1e9 / frequency, max_rtt,
+          (double)max_rtt * 1e9 / frequency);
+  if (offsets) {
+    fprintf(stderr,
+            "[TSC] max error of the correction: %" PRIu64 " ticks (%.1f ns)\n",
+            max_error, (double)max_error * 1e9 / frequency);
+  }
+
+  free(skew);
+}
@@ -0,0 +1,122 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <tunedb.h>
+
+#ifndef BUILD_FLAGS
+#define BUILD_FLAGS ""
+#endif
+
+#ifdef __VERSION__
+#define COMPILER __VERSION__
+#else
+#define COMPILER "unknown"
+#endif
+
+/* FNV-1a */
+static uint64_t hash(const char *str) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (; *str; ++str) {
+    h = (h ^ (uint64_t)(unsigned char)*str) * 0x100000001b3ULL;
+  }
+  return h;
+}
+
+void tunedb_key(tune_key_t *key, hwloc_topology_t topology) {
+  static char host[256];
+  if (gethostname(host, sizeof(host))) {
+    strcpy(host, "unknown");
+  }
+  host[sizeof(host) - 1] = '\0';
+  key->host = host;
+
+  /* hwloc 2 has the model on the packages, 1.x on the root. */
+  key->cpu_model = hwloc_obj_get_info_by_name(
+      hwloc_get_root_obj(topology), "CPUModel");
+  hwloc_obj_t package =
+      hwloc_get_obj_by_type(topology, HWLOC_OBJ_PACKAGE, 0);
+  if (key->cpu_model == NULL && package) {
+    key->cpu_model = hwloc_obj_get_info_by_name(package, "CPUModel");
+  }
+  if (key->cpu_model == NULL) {
+    key->cpu_model = "unknown";
+  }
+
+  key->build = hash(COMPILER " " BUILD_FLAGS);
+}
+
+char *tunedb_default_path(void) {
+  char *path = NULL;
+  const char *cache = getenv("XDG_CACHE_HOME");
+  if (cache && *cache) {
+    return (asprintf(&path, "%s/hwperfvar-tuning", cache) < 0) ? NULL : path;
+  }
+  const char *home = getenv("HOME");
+  if (home == NULL || *home == '\0' ||
+      asprintf(&path, "%s/.cache", home) < 0) {
+    return NULL;
+  }
+  const int err = mkdir(path, 0700) && errno != EEXIST;
+  free(path);
+  if (err || asprintf(&path, "%s/.cache/hwperfvar-tuning", home) < 0) {
+    return NULL;
+  }
+  return path;
+}
+
+/* The key as written to the database, without the rounds. */
+static char *format_key(const tune_key_t *key) {
+  char *line;
+  const int err = asprintf(&line,
+           "%s\t%s\t%s\t%s\t%" PRIu64 "\t%g\t%s\t%g\t%s\t%016" PRIx64 "\t",
+           key->host, key->cpu_model, key->benchmark, key->args, key->size,
+           key->fill, key->cpuset, key->time, key->core, key->build);
+  if (err < 0) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return line;
+}
+
+int tunedb_lookup(const char *path, const tune_key_t *key, unsigned *rounds) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return -1;
+  }
+
+  char *prefix = format_key(key);
+  const size_t length = strlen(prefix);
+  char *line = NULL;
+  size_t size = 0;
+  int found = -1;
+  while (getline(&line, &size, file) != -1) {
+    unsigned value;
+    if (strncmp(line, prefix, length) == 0 &&
+        sscanf(&line[length], "%u", &value) == 1 && value > 0) {
+      *rounds = value;
+      found = 0;
+    }
+  }
+  free(line);
+  free(prefix);
+  fclose(file);
+  return found;
+}
+
+void tunedb_store(const char *path, const tune_key_t *key,
+                  const unsigned rounds) {
+  FILE *file = fopen(path, "a");
+  if (file == NULL) {
+    fprintf(stderr, "[Tune] Could not update %s: %s\n", path, strerror(errno));
+    return;
+  }
+  char *prefix = format_key(key);
+  fprintf(file, "%s%u\n", prefix, rounds);
+  free(prefix);
+  fclose(file);
+}
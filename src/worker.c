@@ -1,5 +1,7 @@
 #include <assert.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,14 +12,61 @@
 #include <sched.h>
 #endif
 
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #include <hwloc.h>
 
 #include <worker.h>
+#include <alloc.h>
 #include <arch.h>
 #include <platform.h>
 #include <mckernel.h>
+#include <timer.h>
+
+/**
+ * Build the arrival tree of the tournament barrier after the hwloc topology.
+ *
+ * The first participant below a topology object collects the arrival of all
+ * other participants below that object, before it reports to the first
+ * participant of the enclosing object. Threads sharing a core or a cache thus
+ * synchronize among themselves first, and only one of them crosses to the
+ * next level.
+ **/
+static unsigned *topology_tree(const thread_data_t *participants,
+                               const unsigned threads) {
+  unsigned *parent = (unsigned *)malloc(sizeof(unsigned) * threads);
+  if (parent == NULL)
+    return NULL;
 
-step_t *init_step(const int threads) {
+  for (unsigned i = 0; i < threads; ++i) {
+    const struct arg *arg = &participants[i].thread_arg;
+    hwloc_obj_t obj = hwloc_get_pu_obj_by_os_index(arg->topology, arg->cpu);
+
+    parent[i] = i;
+    for (; obj != NULL && parent[i] == i; obj = obj->parent) {
+      for (unsigned j = 0; j < i; ++j) {
+        if (hwloc_bitmap_isset(obj->cpuset, participants[j].thread_arg.cpu)) {
+          parent[i] = j;
+          break;
+        }
+      }
+    }
+
+    /* CPU unknown to hwloc; report directly to the root. */
+    if (parent[i] == i && i > 0) {
+      parent[i] = 0;
+    }
+  }
+
+  return parent;
+}
+
+step_t *init_step(const int threads, const enum barrier_type type,
+                  const thread_data_t *participants) {
   step_t *step = (step_t *)malloc(sizeof(step_t));
   if (step == NULL)
     return NULL;
@@ -26,8 +75,43 @@ step_t *init_step(const int threads) {
   if (step->work == NULL)
     return NULL;
 
-  // TODO: error handling.
-  pthread_barrier_init(&step->barrier, NULL, (unsigned)threads);
+  for (int i = 0; i < threads; ++i) {
+    step->work[i].thread = (unsigned)i;
+    step->work[i].release = 0;
+    step->work[i].lockstep = 0;
+    step->work[i].starts = NULL;
+    step->work[i].deadlines = NULL;
+    step->work[i].lead = 0;
+    step->work[i].period = 0;
+    step->work[i].offset = 0;
+    step->work[i].correct = 0;
+    step->work[i].samples = NULL;
+    step->work[i].sink = NULL;
+    step->work[i].stats = NULL;
+    step->work[i].summaries = NULL;
+    step->work[i].warmup = NULL;
+    step->work[i].warmed_up = 0;
+    step->work[i].ci = 0.0;
+    step->work[i].min_reps = 0;
+    step->work[i].completed = 0;
+    step->work[i].ci_width = 0.0;
+    step->work[i].cache = NULL;
+  }
+  step->deadlines = NULL;
+
+  unsigned *parent = NULL;
+  if (type == BARRIER_TOURNAMENT && participants != NULL) {
+    parent = topology_tree(participants, (unsigned)threads);
+  }
+
+  const int err =
+      barrier_init(&step->barrier, type, (unsigned)threads, parent);
+  free(parent);
+  if (err) {
+    fprintf(stderr, "Error initializing %s barrier: %s\n", barrier_name(type),
+            strerror(err));
+    exit(EXIT_FAILURE);
+  }
 
   step->threads = threads;
 
@@ -35,56 +119,193 @@ step_t *init_step(const int threads) {
 }
 
 void free_step(step_t *step) {
-  pthread_barrier_destroy(&step->barrier);
+  barrier_destroy(&step->barrier);
+  free(step->deadlines);
   free(step->work);
   free(step);
 }
 
+/**
+ * Apply the synchronization settings of the workers to a step.
+ *
+ * The work items of the step have to belong to the first step->threads
+ * workers, in order.
+ **/
+void step_synchronize(step_t *step, const threads_t *workers,
+                      const unsigned reps) {
+  if (workers->deadline) {
+    /* Lockstep warm-up is fixed, else only the first deadline is shared. */
+    const unsigned warmup = workers->warmup ? workers->warmup->max : 0;
+    step->deadlines = (uint64_t *)calloc(reps + warmup, sizeof(uint64_t));
+    if (step->deadlines == NULL) {
+      fprintf(stderr, "Error allocating memory\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  for (int i = 0; i < step->threads; ++i) {
+    work_t *work = &step->work[i];
+    work->lockstep = workers->lockstep;
+    work->deadlines = step->deadlines;
+    work->lead = workers->lead;
+    work->period = workers->period;
+    work->offset = workers->offsets ? workers->offsets[i] : 0;
+    work->correct = workers->correct && workers->offsets;
+    work->warmup = workers->warmup;
+    work->ci = workers->ci;
+    work->min_reps = workers->min_reps;
+    work->cache = workers->cache;
+  }
+}
+
+/**
+ * Time between the first and the last thread leaving the barrier of a step.
+ *
+ * Timestamps are taken on different CPUs; offsets between their clocks are
+ * part of the result unless the step corrects them.
+ **/
+uint64_t step_release_skew(const step_t *step) {
+  uint64_t first = UINT64_MAX;
+  uint64_t last = 0;
+
+  for (int i = 0; i < step->threads; ++i) {
+    const work_t *work = &step->work[i];
+    const uint64_t release =
+        work->release - (work->correct ? (uint64_t)work->offset : 0);
+    first = (release < first) ? release : first;
+    last = (release > last) ? release : last;
+  }
+
+  return (step->threads > 0) ? last - first : 0;
+}
+
+/* Spin iterations before WAIT_SPIN_FUTEX goes to sleep. */
+#ifndef WAIT_SPIN_LIMIT
+#define WAIT_SPIN_LIMIT (1U << 16)
+#endif
+
+const char *wait_policy_name(const enum wait_policy policy) {
+  switch (policy) {
+  case WAIT_SPIN:
+    return "spin";
+  case WAIT_SPIN_FUTEX:
+    return "spin-then-futex";
+  case WAIT_CONDVAR:
+    return "condvar";
+  case NR_WAIT_POLICIES:
+    break;
+  }
+  return "unknown";
+}
+
+#ifdef __linux__
+static void futex_wait(uint32_t *addr, const uint32_t val) {
+  /* EAGAIN and EINTR just mean "check again". */
+  syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(uint32_t *addr) {
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+#endif
+
+static inline uint32_t load_state(const struct arg *arg) {
+  return __atomic_load_n(&arg->s, __ATOMIC_ACQUIRE);
+}
+
+static void await_state(struct arg *arg, const enum state s) {
+  switch (arg->wait) {
+  case WAIT_SPIN:
+    while (load_state(arg) != s) {
+      arch_relax();
+    }
+    return;
+  case WAIT_SPIN_FUTEX:
+    for (unsigned i = 0; i < WAIT_SPIN_LIMIT; ++i) {
+      if (load_state(arg) == s) {
+        return;
+      }
+      arch_relax();
+    }
+#ifdef __linux__
+    for (uint32_t current = load_state(arg); current != s;
+         current = load_state(arg)) {
+      /* Pairs with the sequentially consistent store/load in
+       * publish_state(): either the publisher sees us sleeping or the
+       * kernel sees the new state. */
+      __atomic_add_fetch(&arg->sleepers, 1, __ATOMIC_SEQ_CST);
+      futex_wait(&arg->s, current);
+      __atomic_sub_fetch(&arg->sleepers, 1, __ATOMIC_SEQ_CST);
+    }
+    return;
+#endif
+    /* no futex(2): fall back to the condition variable. */
+  case WAIT_CONDVAR:
+  case NR_WAIT_POLICIES:
+    pthread_mutex_lock(&arg->lock);
+    while (load_state(arg) != s) {
+      pthread_cond_wait(&arg->cv, &arg->lock);
+    }
+    pthread_mutex_unlock(&arg->lock);
+    return;
+  }
+}
+
+static void publish_state(struct arg *arg, const enum state s) {
+  switch (arg->wait) {
+  case WAIT_SPIN:
+    __atomic_store_n(&arg->s, s, __ATOMIC_RELEASE);
+    return;
+  case WAIT_SPIN_FUTEX:
+#ifdef __linux__
+    __atomic_store_n(&arg->s, s, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&arg->sleepers, __ATOMIC_SEQ_CST)) {
+      futex_wake(&arg->s);
+    }
+    return;
+#endif
+  case WAIT_CONDVAR:
+  case NR_WAIT_POLICIES:
+    pthread_mutex_lock(&arg->lock);
+    __atomic_store_n(&arg->s, s, __ATOMIC_RELEASE);
+    pthread_cond_signal(&arg->cv);
+    pthread_mutex_unlock(&arg->lock);
+    return;
+  }
+}
+
 void queue_work(struct arg *arg, work_t *work) {
-  pthread_mutex_lock(&arg->lock);
+  assert(load_state(arg) == IDLE);
   assert(arg->work == NULL);
-  assert(arg->s == IDLE);
   arg->work = work;
-  arg->s = QUEUED;
-  pthread_cond_signal(&arg->cv);
-  pthread_mutex_unlock(&arg->lock);
+  publish_state(arg, QUEUED);
 }
 
 work_t * wait_until_done(struct arg *arg) {
-  pthread_mutex_lock(&arg->lock);
-  while (*(volatile enum state *)&arg->s != DONE) {
-    pthread_cond_wait(&arg->cv, &arg->lock);
-  }
+  await_state(arg, DONE);
   work_t *work = arg->work;
   arg->work = NULL;
-  arg->s = IDLE;
-  pthread_mutex_unlock(&arg->lock);
+  publish_state(arg, IDLE);
 
   return work;
 }
 
 static work_t *wait_for_work(struct arg *arg) {
-  pthread_mutex_lock(&arg->lock);
-  assert(arg->s != WORKING);
-  while (*(volatile enum state *)&arg->s != QUEUED) {
-    pthread_cond_wait(&arg->cv, &arg->lock);
-  }
+  assert(load_state(arg) != WORKING);
+  await_state(arg, QUEUED);
   work_t *work = arg->work;
   arg->work = NULL;
-  arg->s = WORKING;
-  pthread_mutex_unlock(&arg->lock);
+  /* Nobody waits for WORKING, a plain store suffices. */
+  __atomic_store_n(&arg->s, WORKING, __ATOMIC_RELAXED);
 
   return work;
 }
 
 static void return_finished_work(struct arg *arg, work_t *work) {
-  pthread_mutex_lock(&arg->lock);
+  assert(load_state(arg) == WORKING);
   assert(arg->work == NULL);
-  assert(arg->s == WORKING);
   arg->work = work;
-  arg->s = DONE;
-  pthread_cond_signal(&arg->cv);
-  pthread_mutex_unlock(&arg->lock);
+  publish_state(arg, DONE);
 }
 
 #ifndef __sparc
@@ -151,6 +372,39 @@ static unsigned current_cpu_getaffinity() {
 }
 #endif
 
+/**
+ * Spin until the deadline for the start of repetition rep.
+ *
+ * Thread 0 publishes the first deadline, and with lockstep but no period one
+ * per repetition. It does so right after the barrier, so that all threads
+ * are initialized and only have to pick it up. With a period, repetition rep
+ * starts rep periods after the first deadline.
+ **/
+static void wait_for_deadline(work_t *work, const unsigned rep) {
+  uint64_t deadline;
+
+  if (work->period && rep > 0) {
+    deadline = work->deadlines[0] + rep * work->period;
+  } else if (rep == 0 || work->lockstep) {
+    if (work->thread == 0) {
+      deadline = arch_timestamp_begin() + work->lead;
+      __atomic_store_n(&work->deadlines[rep], deadline, __ATOMIC_RELEASE);
+    } else {
+      while ((deadline = __atomic_load_n(&work->deadlines[rep],
+                                         __ATOMIC_ACQUIRE)) == 0) {
+        arch_relax();
+      }
+    }
+  } else {
+    return;
+  }
+
+  deadline += (uint64_t)work->offset;
+  while (arch_timestamp_begin() < deadline) {
+    arch_relax();
+  }
+}
+
 static void bind_thread(struct arg *arg) {
   if (arg->do_binding) {
     if (hwloc_topology_is_thissystem(arg->topology)) {
@@ -227,20 +481,17 @@ void *worker(void *arg_) {
   int dirigent = arg->dirigent;
 
   if (dirigent && !arg->init) {
-#if defined(PERF)
-    const char *method = "perf";
-#elif defined(JEVENTS)
-    const char *method = "jevents";
-#elif defined(RAWMSR)
-    const char *method = "rawmsr";
-#else
-    const char *method = "none";
-#endif
-    fprintf(stderr, "PMU method: %s\n", method);
+    fprintf(stderr, "PMU method: %s\n", arg->pmu->name);
+    fprintf(stderr, "Wait policy: %s\n", wait_policy_name(arg->wait));
+    fprintf(stderr, "Timer: %s\n", timer_name(arg->timer.type));
   }
 
   if (!arg->init) {
     bind_thread(arg);
+    /* After binding, so the overhead is measured on the right CPU. */
+    timer_init(&arg->timer);
+    fprintf(stderr, "[Timer] CPU %2u: overhead %" PRIu64 " ticks\n", arg->cpu,
+            arg->timer.overhead);
     arg->init = 1;
   }
 
@@ -252,43 +503,157 @@ void *worker(void *arg_) {
     void *benchmark_arg =
         (work->ops->init_arg) ? work->ops->init_arg(work->arg) : work->arg;
 
-    struct pmu *pmus = arch_pmu_init(work->pmcs, work->num_pmcs, arg->cpu);
+    const pmu_backend_t *pmu = arg->pmu;
+    struct pmu *pmus =
+        work->num_pmcs
+            ? pmu->init(work->pmcs, work->num_pmcs, arg->cpu, arg->pmu_config)
+            : NULL;
+    struct sampler *sampler =
+        work->samples ? sampler_open(arg->sample_config, arg->cpu) : NULL;
 
     {
-      const int err = pthread_barrier_wait(work->barrier);
+      const int err = barrier_wait(work->barrier, work->thread);
+      work->release = arch_timestamp_begin();
       if (err && err != PTHREAD_BARRIER_SERIAL_THREAD) {
-        perror("pthread_barrier_wait() failed");
+        fprintf(stderr, "barrier_wait() failed: %s\n", strerror(err));
       }
     }
 
-    // reps = warm-up + benchmark runs.
-    for (unsigned rep = 0; rep < work->reps; ++rep) {
+    /* Warm-up repetitions are measured like the others, but only to decide
+     * when they are over; their samples are overwritten. */
+    const warmup_config_t *warmup = work->warmup;
+    int warming = warmup && warmup->max;
+    unsigned warmed_up = 0;
+    steady_t steady;
+    if (warming) {
+      steady_init(&steady, warmup->window, warmup->cv);
+    }
+    median_ci_t median;
+    if (work->ci != 0.0) {
+      median_ci_init(&median, work->reps);
+    }
+    if (work->cache && arg->cache.size == 0) {
+      cache_buffer_init(&arg->cache, work->cache, arg->topology, arg->cpuset);
+    }
+
+    // runs = warm-up + benchmark runs.
+    unsigned rep = 0;
+    for (unsigned run = 0; rep < work->reps; ++run) {
       if (work->ops->reset_arg) {
         work->ops->reset_arg(benchmark_arg);
       }
+      if (work->cache) {
+        cache_prepare(work->cache, &arg->cache);
+      }
 
-      const uint64_t offset = (work->num_pmcs + 1) * rep;
-      if (work->result) {
-        arch_pmu_begin(pmus, &work->result[offset + 1]);
+      if (work->lockstep) {
+        const int err = barrier_wait(work->barrier, work->thread);
+        if (err && err != PTHREAD_BARRIER_SERIAL_THREAD) {
+          fprintf(stderr, "barrier_wait() failed: %s\n", strerror(err));
+        }
+      }
+
+      if (work->deadlines) {
+        wait_for_deadline(work, run);
+      }
+
+      /* Streaming and online statistics keep only the current repetition. */
+      const unsigned slot = (warming || work->sink || work->stats) ? 0 : rep;
+      const uint64_t offset = (work->num_pmcs + 1) * slot;
+      if (work->result && pmus) {
+        pmu->begin(pmus, &work->result[offset + 1]);
+      }
+      if (sampler && !warming) {
+        sampler_begin(sampler);
+      }
+      /* Starts are compared across threads; they are always timestamps. */
+      if (work->starts) {
+        work->starts[slot] = arch_timestamp_begin() -
+                            (work->correct ? (uint64_t)work->offset : 0);
       }
-      const uint64_t start = arch_timestamp_begin();
+      const uint64_t start = arch_timer_begin(&arg->timer);
       work->ops->call(benchmark_arg);
-      const uint64_t end = arch_timestamp_end();
+      const uint64_t end = arch_timer_end(&arg->timer);
+      if (sampler && !warming) {
+        sampler_end(sampler);
+      }
+      const uint64_t elapsed = timer_elapsed(&arg->timer, start, end);
+      if (warming) {
+        if (work->result && pmus) {
+          pmu->end(pmus, &work->result[offset + 1]);
+        }
+        ++warmed_up;
+        warming = warmed_up < warmup->max &&
+                  (warmed_up < warmup->min || !steady_add(&steady, elapsed));
+        continue;
+      }
       if (work->result) {
-        arch_pmu_end(pmus, &work->result[offset + 1]);
-        work->result[offset] = end - start;
+        if (pmus) {
+          pmu->end(pmus, &work->result[offset + 1]);
+        }
+        work->result[offset] = elapsed;
+        if (work->sink) {
+          sink_push(work->sink, rep, work->starts ? work->starts[0] : 0,
+                    &work->result[0]);
+        }
+        if (work->stats) {
+          for (unsigned i = 0; i < work->num_pmcs + 1; ++i) {
+            if (i == 0 || work->result[i] != PMU_NOT_COUNTED) {
+              stats_add(&work->stats[i], work->result[i]);
+            }
+          }
+        }
+      }
+      /* Outside the timed region, before the buffer can overflow. */
+      if (sampler) {
+        sampler_drain(sampler, &work->samples[rep]);
       }
+      ++rep;
+      if (work->ci != 0.0) {
+        median_ci_add(&median, elapsed);
+        if (rep >= work->min_reps && median_ci_width(&median) <= work->ci) {
+          break;
+        }
+      }
+    }
+    if (warmup && warmup->max) {
+      steady_free(&steady);
+    }
+    work->warmed_up = warmed_up;
+    work->completed = rep;
+    if (work->ci != 0.0) {
+      work->ci_width = median_ci_width(&median);
+      median_ci_free(&median);
     }
 
-    arch_pmu_free(pmus);
+    if (pmus) {
+      pmu->free(pmus);
+    }
+    if (sampler) {
+      sampler_close(sampler);
+    }
+    /* Benchmarks are set up anew for every run, e.g. by --sweep. */
+    if (work->ops->init_arg && work->ops->free_arg) {
+      work->ops->free_arg(benchmark_arg);
+    }
+    benchmark_arena_reset();
+    /* Each worker sorts out its own quantiles. */
+    if (work->stats) {
+      for (unsigned i = 0; i < work->num_pmcs + 1; ++i) {
+        stats_summarize(&work->stats[i], &work->summaries[i]);
+      }
+    }
     return_finished_work(arg, work);
 
     if (dirigent)
       break;
   }
 
-  if (!dirigent)
+  if (!dirigent) {
+    timer_free(&arg->timer);
+    cache_buffer_free(&arg->cache);
     fprintf(stderr, "Thread %s stopped.\n", arg->cpuset_string);
+  }
 
   return NULL;
 }